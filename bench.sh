@@ -0,0 +1,96 @@
+#!/bin/bash
+# Benchmarks lsh and prints the results as one JSON object, so runs from different releases
+# can be compared. Each macrobenchmark is the best of $RUNS runs of ./lsh on a generated
+# workload; the in-process microbenchmarks come from bench_lsh. Run with `make bench`.
+#
+# usage: bench.sh [lsh_path]
+
+set -e
+
+LSH=${1:-./lsh}
+RUNS=${RUNS:-3}
+SCALE=${SCALE:-1}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Best wall time in nanoseconds of running the given command $RUNS times.
+best_ns() {
+	local best=
+	for ((run = 0; run < RUNS; run++)); do
+		local start=$(date +%s%N)
+		"$@" > /dev/null || { echo "bench.sh: $* failed" >&2; exit 1; }
+		local t=$(($(date +%s%N) - start))
+		if [ -z "$best" ] || [ "$t" -lt "$best" ]; then
+			best=$t
+		fi
+	done
+	echo "$best"
+}
+
+# The arithmetic expression a / b to one decimal place.
+ratio() {
+	awk "BEGIN { printf \"%.1f\", ($1) / ($2) }"
+}
+
+# Parser: a large script of assorted statements, parsed with -n so nothing runs.
+parse_lines=$((100000 * SCALE))
+for ((i = 0; i < parse_lines / 10; i++)); do
+	echo "X$i=value$i"
+	echo "echo hello \$X$i world"
+	echo "if grep -q needle haystack ; then"
+	echo "	cat a b c | sort | uniq -c | head -n 10"
+	echo "else"
+	echo "	true"
+	echo "fi"
+	echo "for x in a b c d e f ; do"
+	echo "	echo \$x"
+	echo "done"
+done > "$WORK/parse.sh"
+parse_bytes=$(stat -c %s "$WORK/parse.sh")
+parse_ns=$(best_ns "$LSH" -n "$WORK/parse.sh")
+
+# For loops: iterations that only assign a variable, so no process is started.
+loop_iterations=$((100000 * SCALE))
+{
+	printf 'for i in'
+	seq -s ' ' "$loop_iterations" | sed 's/^/ /'
+	echo ' ; do'
+	echo '	X=$i'
+	echo 'done'
+} > "$WORK/loop.sh"
+loop_ns=$(best_ns "$LSH" "$WORK/loop.sh")
+
+# Arithmetic: the same loop keeping a running total with $((...)).
+sed 's/X=\$i/N=$((N + i * 2))/' "$WORK/loop.sh" > "$WORK/arith.sh"
+arith_ns=$(best_ns "$LSH" "$WORK/arith.sh")
+
+# Line reading: a while read loop over a file, with no process per line.
+read_lines=$((200000 * SCALE))
+seq "$read_lines" > "$WORK/lines"
+read_ns=$(best_ns "$LSH" -c "while read line ; do X=\$line ; done < $WORK/lines")
+
+# fork+exec: one external program per line.
+spawns=$((1000 * SCALE))
+yes /bin/true | head -n "$spawns" > "$WORK/spawn.sh"
+spawn_ns=$(best_ns "$LSH" "$WORK/spawn.sh")
+
+# Pipelines: bytes pushed through a four stage pipeline.
+pipe_bytes=$((256 * 1024 * 1024 * SCALE))
+pipe_ns=$(best_ns "$LSH" -c "head -c $pipe_bytes /dev/zero | cat | cat | wc -c")
+
+# Startup: running `lsh -c true` to completion.
+starts=$((200 * SCALE))
+start_ns=$(best_ns bash -c "for ((i = 0; i < $starts; i++)); do $LSH -c true || exit 1; done")
+
+echo "{"
+echo "  \"parse_mb_per_s\": $(ratio "$parse_bytes * 1000" "$parse_ns"),"
+echo "  \"parse_lines_per_s\": $(ratio "$parse_lines * 1e9" "$parse_ns"),"
+echo "  \"for_iterations_per_s\": $(ratio "$loop_iterations * 1e9" "$loop_ns"),"
+echo "  \"arith_iterations_per_s\": $(ratio "$loop_iterations * 1e9" "$arith_ns"),"
+echo "  \"read_lines_per_s\": $(ratio "$read_lines * 1e9" "$read_ns"),"
+echo "  \"spawn_us\": $(ratio "$spawn_ns" "$spawns * 1000"),"
+echo "  \"pipeline_mb_per_s\": $(ratio "$pipe_bytes * 1000" "$pipe_ns"),"
+echo "  \"startup_us\": $(ratio "$start_ns" "$starts * 1000"),"
+# Splice bench_lsh's members into this object.
+./bench_lsh | sed '1d;$d'
+echo "}"
@@ -0,0 +1,143 @@
+// Measures the cost of building a command's argv: heap allocations and time per command,
+// for make_argv() against the byte-at-a-time builder it replaced (kept here as a baseline).
+// Allocations are counted by linking with -Wl,--wrap=malloc,... so only calls made from
+// lsh's own objects and this file are seen.
+//
+// usage: bench_argv [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "lsh_ast.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+static long allocs;
+
+void *__wrap_malloc(size_t size) {
+	allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+	allocs++;
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+	allocs++;
+	return __real_realloc(p, size);
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The previous make_argv(): grow an 8 byte inline buffer a byte at a time, then split it.
+struct old_argv_buf {
+	char **argv;
+	int argc;
+	size_t used;
+	size_t capacity;
+	char buf[8];
+};
+
+static struct old_argv_buf *old_putchar(struct old_argv_buf *buf, char c) {
+	if (buf->used >= buf->capacity - 1) {
+		buf->capacity <<= 1;
+		buf = realloc(buf, sizeof(*buf) + buf->capacity);
+	}
+	buf->buf[buf->used++] = c;
+	return buf;
+}
+
+static struct old_argv_buf *old_make_argv(const struct context *context, const struct words *words) {
+	struct old_argv_buf *buf = malloc(sizeof(*buf));
+	buf->argc = 0;
+	buf->used = 0;
+	buf->capacity = sizeof(buf->buf);
+	for (const struct word *word = words->first; word != NULL; word = word->next) {
+		const char *s = word->is_var ? context_get_var(context, word->text) : word->text;
+		for (const char *c = s; c && *c; c++)
+			buf = old_putchar(buf, *c);
+		buf = old_putchar(buf, 0);
+	}
+	int max_argc = 2;
+	buf->argv = malloc(sizeof(char *) * (max_argc + 1));
+	int in_word = 0;
+	for (size_t i = 0; i < buf->used; i++) {
+		char *c = &buf->buf[i];
+		if (buf->argc == max_argc - 1) {
+			max_argc <<= 1;
+			buf->argv = realloc(buf->argv, sizeof(char *) * (max_argc + 1));
+		}
+		if (!in_word && !isspace(*c) && *c != 0) {
+			in_word = 1;
+			buf->argv[buf->argc++] = c;
+		} else if (in_word && (isspace(*c) || *c == 0)) {
+			in_word = 0;
+			*c = 0;
+		} else if (!in_word) {
+			*c = 0;
+		}
+	}
+	buf->argv[buf->argc] = NULL;
+	return buf;
+}
+
+static struct words *parse_words(struct arena *arena, char *line) {
+	struct words *words = new_words(arena);
+	for (char *tok = strtok(line, " "); tok != NULL; tok = strtok(NULL, " ")) {
+		struct word *w = new_word(arena);
+		w->is_var = tok[0] == '$';
+		w->text = arena_strdup(arena, tok + w->is_var);
+		append_ll(words, w);
+	}
+	return words;
+}
+
+static void run(struct context *context, const char *name, const char *command, int iterations) {
+	char line[256];
+	snprintf(line, sizeof(line), "%s", command);
+	struct words *words = parse_words(&context->arena, line);
+
+	long a = allocs;
+	double start = now_ns();
+	for (int i = 0; i < iterations; i++) {
+		struct old_argv_buf *buf = old_make_argv(context, words);
+		free(buf->argv);
+		free(buf);
+	}
+	double old_ns = (now_ns() - start) / iterations;
+	double old_allocs = (double)(allocs - a) / iterations;
+
+	a = allocs;
+	start = now_ns();
+	for (int i = 0; i < iterations; i++)
+		free_argv(context, make_argv(context, &context->scratch, words));
+	double new_ns = (now_ns() - start) / iterations;
+	double new_allocs = (double)(allocs - a) / iterations;
+
+	printf("%-10s %12.2f %12.1f %12.2f %12.1f\n", name, old_allocs, old_ns, new_allocs, new_ns);
+}
+
+int main(int argc, char **argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+	struct context *context = new_context();
+	context_set_var(context, "DIR", "/usr/local/share/doc");
+	context_set_var(context, "FLAGS", "-l -a -h --color=never");
+
+	printf("%-10s %12s %12s %12s %12s\n", "command", "old_allocs", "old_ns", "new_allocs", "new_ns");
+	run(context, "short", "true", iterations);
+	run(context, "literal", "grep -n -e pattern --include=*.c src/lsh_ast.c", iterations);
+	run(context, "vars", "ls $FLAGS $DIR $DIR/lsh $UNSET", iterations);
+	free_context(context);
+	return 0;
+}
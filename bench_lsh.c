@@ -0,0 +1,99 @@
+// In-process microbenchmarks of the shell's hot paths, printed as JSON members
+// ("name": nanoseconds per call) for bench.sh to merge into its report.
+//
+// usage: bench_lsh [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lsh_ast.h"
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Split command into words as the parser would, with variables resolved to their slots.
+static struct words *parse_words(struct context *context, struct arena *arena, const char *command) {
+	char line[256];
+	snprintf(line, sizeof(line), "%s", command);
+	struct words *words = new_words(arena);
+	for (char *tok = strtok(line, " "); tok != NULL; tok = strtok(NULL, " ")) {
+		struct word *w = new_word(arena);
+		w->is_var = tok[0] == '$';
+		w->text = arena_strdup(arena, tok + w->is_var);
+		w->slot = w->is_var ? context_var_slot(context, w->text) : 0;
+		append_ll(words, w);
+	}
+	return words;
+}
+
+static void report(const char *name, double start, int iterations, int last) {
+	printf("  \"%s\": %.1f%s\n", name, (now_ns() - start) / iterations, last ? "" : ",");
+}
+
+static void bench_make_argv(struct context *context, const char *name, const char *command, int iterations) {
+	struct words *words = parse_words(context, &context->arena, command);
+	double start = now_ns();
+	for (int i = 0; i < iterations; i++)
+		free_argv(context, make_argv(context, &context->scratch, words));
+	report(name, start, iterations, 0);
+}
+
+int main(int argc, char **argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+	struct context *context = new_context();
+	context_set_var(context, "DIR", "/usr/local/share/doc");
+	context_set_var(context, "FLAGS", "-l -a -h --color=never");
+
+	printf("{\n");
+	bench_make_argv(context, "make_argv_literal_ns", "grep -n -e pattern --include=*.c src/lsh_ast.c", iterations);
+	bench_make_argv(context, "make_argv_vars_ns", "ls $FLAGS $DIR $DIR/lsh $UNSET", iterations);
+
+	// Overwriting one variable, as a for loop does every iteration.
+	char value[16];
+	double start = now_ns();
+	for (int i = 0; i < iterations; i++) {
+		snprintf(value, sizeof(value), "%d", i);
+		context_set_var(context, "i", value);
+	}
+	report("set_var_ns", start, iterations, 0);
+
+	// The same through the variable's slot, as a for loop compiled by the parser does.
+	int slot = context_var_slot(context, "i");
+	start = now_ns();
+	for (int i = 0; i < iterations; i++) {
+		snprintf(value, sizeof(value), "%d", i);
+		context_set_slot(context, slot, value);
+	}
+	report("set_slot_ns", start, iterations, 0);
+
+	// Creating distinct variables, which grows the table.
+	int distinct = iterations < 100000 ? iterations : 100000;
+	char name[32];
+	start = now_ns();
+	for (int i = 0; i < distinct; i++) {
+		snprintf(name, sizeof(name), "VAR_%d", i);
+		context_set_var(context, name, name);
+	}
+	report("set_new_var_ns", start, distinct, 0);
+
+	start = now_ns();
+	const char *v = NULL;
+	for (int i = 0; i < iterations; i++)
+		v = context_get_var(context, (i & 1) ? "DIR" : "FLAGS");
+	report("get_var_ns", start, iterations, 0);
+
+	int dir = context_var_slot(context, "DIR"), flags = context_var_slot(context, "FLAGS");
+	start = now_ns();
+	for (int i = 0; i < iterations; i++)
+		v = context_get_slot(context, (i & 1) ? dir : flags);
+	report("get_slot_ns", start, iterations, 1);
+	printf("}\n");
+
+	free_context(context);
+	return v == NULL;
+}
@@ -0,0 +1,90 @@
+// Compares process launch latency of fork()+execv() against posix_spawn() as the
+// launching process's resident set grows, which is the situation lsh is in after
+// loading a large environment or script.
+//
+// usage: bench_spawn [iterations] [max_rss_mb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static const char *prog = "/bin/true";
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void reap(pid_t pid) {
+	int status;
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "child %d failed\n", pid);
+		exit(1);
+	}
+}
+
+static double time_fork(int iterations) {
+	char *argv[] = { (char *)prog, NULL };
+	double start = now_us();
+	for (int i = 0; i < iterations; i++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			execv(prog, argv);
+			_exit(127);
+		}
+		if (pid == -1) {
+			perror("fork");
+			exit(1);
+		}
+		reap(pid);
+	}
+	return (now_us() - start) / iterations;
+}
+
+static double time_spawn(int iterations) {
+	char *argv[] = { (char *)prog, NULL };
+	double start = now_us();
+	for (int i = 0; i < iterations; i++) {
+		pid_t pid;
+		int err = posix_spawn(&pid, prog, NULL, NULL, argv, environ);
+		if (err != 0) {
+			fprintf(stderr, "posix_spawn: %s\n", strerror(err));
+			exit(1);
+		}
+		reap(pid);
+	}
+	return (now_us() - start) / iterations;
+}
+
+int main(int argc, char **argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 200;
+	size_t max_mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+	char *ballast = NULL;
+	size_t rss_mb = 0;
+
+	printf("%10s %14s %14s %8s\n", "rss_mb", "fork_exec_us", "posix_spawn_us", "speedup");
+	for (size_t mb = 0; mb <= max_mb; mb = mb ? mb * 4 : 16) {
+		// Grow and touch the ballast so the pages are really resident.
+		ballast = realloc(ballast, mb << 20 ? mb << 20 : 1);
+		if (ballast == NULL) {
+			perror("realloc");
+			return 1;
+		}
+		memset(ballast + (rss_mb << 20), 1, (mb - rss_mb) << 20);
+		rss_mb = mb;
+
+		double f = time_fork(iterations);
+		double s = time_spawn(iterations);
+		printf("%10zu %14.1f %14.1f %7.1fx\n", mb, f, s, f / s);
+		fflush(stdout);
+	}
+	free(ballast);
+	return 0;
+}
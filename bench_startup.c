@@ -0,0 +1,55 @@
+// Measures shell startup latency: the wall time of running `SHELL -c true` to completion,
+// for lsh and for whichever of dash and bash are installed, with the current environment.
+//
+// usage: bench_startup [iterations] [lsh_path]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Average microseconds per `shell -c command`, or -1 if it couldn't be run.
+static double time_shell(const char *shell, const char *command, int iterations) {
+	char *argv[] = { (char *)shell, (char *)"-c", (char *)command, NULL };
+	double start = now_us();
+	for (int i = 0; i < iterations; i++) {
+		pid_t pid;
+		int status;
+		if (posix_spawn(&pid, shell, NULL, NULL, argv, environ) != 0)
+			return -1;
+		if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "%s -c %s failed\n", shell, command);
+			return -1;
+		}
+	}
+	return (now_us() - start) / iterations;
+}
+
+int main(int argc, char **argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+	const char *shells[] = { argc > 2 ? argv[2] : "./lsh", "/bin/dash", "/bin/bash" };
+	const char *commands[] = { "true", "/bin/true" };
+
+	printf("%-12s %12s %12s\n", "shell", "true_us", "/bin/true_us");
+	for (size_t i = 0; i < sizeof(shells) / sizeof(shells[0]); i++) {
+		if (access(shells[i], X_OK) != 0)
+			continue;
+		printf("%-12s", shells[i]);
+		for (size_t j = 0; j < sizeof(commands) / sizeof(commands[0]); j++)
+			printf(" %12.1f", time_shell(shells[i], commands[j], iterations));
+		printf("\n");
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -1,8 +1,9 @@
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <search.h>
-
-#include <readline/readline.h>
+#include <dlfcn.h>
 
 #include "lsh_ast.h"
 #include "lsh.yacc.generated_h"
@@ -13,17 +14,38 @@
 // man 7 environ
 extern char **environ;
 
-int handle_script(struct context *context) {
-	if (context->script) {
-		//print_script(stdout, context->script, 0);
-
-		run_script(context, context->script);	
+static char *(*readline)(const char *prompt);
 
-		free_script(context->script);
-		context->script = NULL;
+// Reading a line without readline: print the prompt and take a line from stdin.
+static char *plain_readline(const char *prompt) {
+	char *line = NULL;
+	size_t size = 0;
+	fputs(prompt, stdout);
+	fflush(stdout);
+	ssize_t n = getline(&line, &size, stdin);
+	if (n == -1) {
+		free(line);
+		return NULL;
 	}
+	if (n > 0 && line[n - 1] == '\n')
+		line[n - 1] = 0;
+	return line;
+}
 
-	return 0;
+// readline is only needed at an interactive prompt. Loading it and libtinfo costs more
+// than everything else `lsh -c true` does, so it's opened when a prompt is first shown.
+static void load_readline(struct context *context) {
+	const char *libs[] = { "libreadline.so.8", "libreadline.so" };
+	readline = plain_readline;
+	for (size_t i = 0; i < sizeof(libs) / sizeof(libs[0]); i++) {
+		void *lib = dlopen(libs[i], RTLD_NOW);
+		void *fn = lib ? dlsym(lib, "readline") : NULL;
+		if (fn != NULL) {
+			memcpy(&readline, &fn, sizeof(fn));	// ISO C has no cast from void * to a function pointer.
+			completion_start(context, lib);	// Tab completion, see lsh_complete.c
+			return;
+		}
+	}
 }
 
 int main(int argc, char **argv)
@@ -31,41 +53,75 @@ int main(int argc, char **argv)
 	struct context *context = new_context();
 	int rc;
 	FILE *finput = NULL;
+	const char *command = NULL;
 	yyscan_t scanner;
 
-	// Load environment into a data structure. These will work as variables for
-	// variable expansion, for example 'echo $HOME'.
-	for (char **p = environ; p && *p; p++) {
-		const char *buf = strdup(*p);
-		void *t = tsearch(buf, &context->env_tree, env_tree_compare);
-		if (buf != *(const char **)t) free((void*)buf);
-	}
-	//twalk(context->env_tree, tsearch_print_env_tree);
+	// The environment works as variables for variable expansion, for example 'echo $HOME'.
+	// It's only copied in when needed, so starting the shell costs the same however big it is.
+	context_set_environ(context, environ);
+
+	// LSH_TRACE=file writes a Chrome trace of what runs to file, see lsh_trace.c
+	const char *trace = getenv("LSH_TRACE");
+	if (trace != NULL && *trace != 0)
+		trace_open(context, trace);
 
 	// Uncomment to get far more parser generator debug output.
-	// This would ordinarily be attached to a flag, but we're not
-	// introducing getopt & friends yet for simplicity.
 	//yydebug = 1;
 
-	yylex_init(&scanner);
+	int opt;
+	while ((opt = getopt(argc, argv, "c:j:n")) != -1) {
+		switch (opt) {
+		case 'c':
+			command = optarg;
+			break;
+		case 'j':
+			// Limit on concurrent pdo iterations; $LSH_JOBS is consulted by each loop.
+			context_set_var(context, "LSH_JOBS", optarg);
+			break;
+		case 'n':
+			// Parse but don't run anything, like sh -n: checks syntax, and measures the parser.
+			context->noexec = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n] [-j jobs] [-c command | script]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	yylex_init_extra(context, &scanner);
 
-	if (argc == 1 && isatty(0)) {
+	if (command != NULL) {
+		// Run a single command line given as an argument, like sh -c.
+		YY_BUFFER_STATE buffer = yy_scan_string(command, scanner);
+		rc = yyparse(context, scanner);
+		free_script(context);
+		yy_delete_buffer(buffer, scanner);
+		if (rc == 0)
+			rc = context->last_status & 0xff;
+	} else if (optind == argc && isatty(0)) {
 		// If stdin is a terminal, and no arguments are specified, assume an interactive terminal is desired.
 		// Use readline() to provide a pleasant-ish experience.
 		char *input;
-		yylex_init(&scanner);
-		while ((input = readline(PROMPT)) != NULL) {
-			yy_switch_to_buffer(yy_scan_string(input, scanner), scanner);
-			if ((rc = yyparse(context, scanner)) == 0) {
-				rc = handle_script(context);
-			}
+		context->interactive = 1;
+		load_readline(context);
+		while (1) {
+			jobs_notify(context);	// Report background jobs that finished since the last prompt.
+			completion_refresh(context);	// Pick up new commands in the background.
+			if ((input = readline(PROMPT)) == NULL)
+				break;
+			YY_BUFFER_STATE buffer = yy_scan_string(input, scanner);
+			context->lex_word_next = 0;	// Each line starts a statement, see lsh.lex
+			// Statements run as they are parsed, see top_statement in lsh.yacc.
+			rc = yyparse(context, scanner);
+			free_script(context);	// Whatever was parsed before a syntax error.
+			yy_delete_buffer(buffer, scanner);
 			free(input);
 		}
 	} else {
 		// Read from a script. By default this is stdin.
-		if (argc > 1) {
+		if (optind < argc) {
 			// If a file is specified as a command line argument, read from that instead of stdin.
-			const char *source = argv[1];
+			const char *source = argv[optind];
 			finput = fopen(source, "rb");
 			if (finput == NULL) {
 				fprintf(stderr, "Could not open '%s' for reading, errno %d (%s)\n", source, errno, strerror(errno));
@@ -73,10 +129,11 @@ int main(int argc, char **argv)
 			}
 			yyset_in(finput, scanner);
 		}
-		// Parse the input file and run the parsed script if parsing was successful.
-		if ((rc = yyparse(context, scanner)) == 0) {
-			rc = handle_script(context);
-		}
+		// Parse the input file, running each statement as soon as it has been parsed.
+		rc = yyparse(context, scanner);
+		free_script(context);
+		if (rc == 0)
+			rc = context->last_status & 0xff;
 	}
 	// Cleanup.
 	yylex_destroy(scanner);
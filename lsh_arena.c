@@ -0,0 +1,89 @@
+// Bump allocator for everything produced by one parse: AST nodes and token text.
+// Nothing in it is freed individually; arena_reset() releases it all at once.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "lsh_ast.h"
+
+#define ARENA_CHUNK_SIZE	(64 * 1024)
+#define ARENA_ALIGN		(sizeof(max_align_t))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+static struct arena_chunk *arena_new_chunk(struct arena *arena, size_t min_size) {
+	size_t size = min_size > ARENA_CHUNK_SIZE ? min_size : ARENA_CHUNK_SIZE;
+	struct arena_chunk *chunk = malloc(sizeof(*chunk) + size);
+	if (chunk == NULL) {
+		fprintf(stderr, "malloc() failed for arena!\n");
+		exit(1);
+	}
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	return chunk;
+}
+
+// Zeroed, suitably aligned memory that lives until the next arena_reset().
+void *arena_alloc(struct arena *arena, size_t size) {
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	struct arena_chunk *chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < size)
+		chunk = arena_new_chunk(arena, size);
+	void *p = (char *)chunk->data + chunk->used;
+	chunk->used += size;
+	memset(p, 0, size);
+	return p;
+}
+
+char *arena_strndup(struct arena *arena, const char *s, size_t n) {
+	char *p = arena_alloc(arena, n + 1);
+	memcpy(p, s, n);
+	return p;
+}
+
+char *arena_strdup(struct arena *arena, const char *s) {
+	return arena_strndup(arena, s, strlen(s));
+}
+
+// Release p and everything allocated after it, for arenas used as a stack. Chunks added
+// since p was allocated are freed, the one holding p is kept.
+void arena_release(struct arena *arena, void *p) {
+	struct arena_chunk *chunk;
+	while ((chunk = arena->chunks) != NULL) {
+		char *data = (char *)chunk->data;
+		if ((char *)p >= data && (char *)p <= data + chunk->used) {
+			chunk->used = (char *)p - data;
+			return;
+		}
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+}
+
+// Release everything allocated since the last reset, keeping one chunk around for the next parse.
+void arena_reset(struct arena *arena) {
+	struct arena_chunk *chunk = arena->chunks;
+	if (chunk == NULL)
+		return;
+	for (struct arena_chunk *next, *c = chunk->next; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	chunk->next = NULL;
+	chunk->used = 0;
+}
+
+void arena_free(struct arena *arena) {
+	arena_reset(arena);
+	free(arena->chunks);
+	arena->chunks = NULL;
+}
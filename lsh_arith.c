@@ -0,0 +1,438 @@
+// Arithmetic: $((expression)) and the let builtin, evaluated in the shell with no process
+// started. Expressions use C's integer operators and precedence, with sh's additions: **,
+// and variables named with or without a $, whose values are read as numbers (empty or unset
+// is 0) and which assignments like x += 2 and x++ set.
+//
+// $((...)) is parsed once, when the script is, into a tree whose variables are already
+// resolved to slots (see lsh_var.c), so evaluating it in a loop reads and writes variables
+// without looking their names up. let's arguments are only known at run time, so they're
+// parsed each time into the scratch arena.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "lsh_ast.h"
+
+enum arith_op {
+	A_NUM, A_VAR,
+	A_NEG, A_PLUS, A_NOT, A_BITNOT, A_PREINC, A_PREDEC, A_POSTINC, A_POSTDEC,
+	A_POW, A_MUL, A_DIV, A_MOD, A_ADD, A_SUB, A_SHL, A_SHR,
+	A_LT, A_LE, A_GT, A_GE, A_EQ, A_NE, A_BAND, A_BXOR, A_BOR, A_AND, A_OR,
+	A_COND, A_ASSIGN, A_COMMA,
+};
+
+struct arith {
+	enum arith_op op;
+	enum arith_op assign_op;	// A_ASSIGN: the operator of op=, A_ASSIGN for plain =.
+	long long value;		// A_NUM
+	const char *name;		// A_VAR
+	int slot;			// A_VAR, 0 for $?
+	struct arith *left, *right, *cond;
+	const char *text;		// The whole expression, on its root, for error messages.
+};
+
+// Operators, longest first so that e.g. <<= isn't read as < or <<. prec is for binary
+// operators, higher binding tighter; assignments are marked with assign.
+static const struct arith_token {
+	const char *text;
+	enum arith_op op;
+	int prec;
+	int assign;
+} tokens[] = {
+	{ "<<=", A_SHL, 0, 1 }, { ">>=", A_SHR, 0, 1 },
+	{ "**", A_POW, 11, 0 }, { "++", A_PREINC, 0, 0 }, { "--", A_PREDEC, 0, 0 },
+	{ "<<", A_SHL, 8, 0 }, { ">>", A_SHR, 8, 0 }, { "<=", A_LE, 7, 0 }, { ">=", A_GE, 7, 0 },
+	{ "==", A_EQ, 6, 0 }, { "!=", A_NE, 6, 0 }, { "&&", A_AND, 2, 0 }, { "||", A_OR, 1, 0 },
+	{ "*=", A_MUL, 0, 1 }, { "/=", A_DIV, 0, 1 }, { "%=", A_MOD, 0, 1 }, { "+=", A_ADD, 0, 1 },
+	{ "-=", A_SUB, 0, 1 }, { "&=", A_BAND, 0, 1 }, { "^=", A_BXOR, 0, 1 }, { "|=", A_BOR, 0, 1 },
+	{ "*", A_MUL, 10, 0 }, { "/", A_DIV, 10, 0 }, { "%", A_MOD, 10, 0 }, { "+", A_ADD, 9, 0 },
+	{ "-", A_SUB, 9, 0 }, { "<", A_LT, 7, 0 }, { ">", A_GT, 7, 0 }, { "&", A_BAND, 5, 0 },
+	{ "^", A_BXOR, 4, 0 }, { "|", A_BOR, 3, 0 }, { "=", A_ASSIGN, 0, 1 },
+	{ "!", A_NOT, 0, 0 }, { "~", A_BITNOT, 0, 0 }, { "?", A_COND, 0, 0 }, { ":", A_COND, 0, 0 },
+	{ ",", A_COMMA, 0, 0 }, { "(", A_NUM, 0, 0 }, { ")", A_NUM, 0, 0 },
+};
+
+struct arith_parser {
+	struct context *context;
+	struct arena *arena;
+	const char *text;	// The whole expression, for error messages.
+	const char *p;
+	int failed;
+};
+
+static void skip_space(struct arith_parser *ap) {
+	while (isspace((unsigned char)*ap->p))
+		ap->p++;
+}
+
+// The operator at the parser's position, NULL if there isn't one.
+static const struct arith_token *peek_token(struct arith_parser *ap) {
+	skip_space(ap);
+	for (size_t i = 0; i < sizeof(tokens) / sizeof(tokens[0]); i++) {
+		if (strncmp(ap->p, tokens[i].text, strlen(tokens[i].text)) == 0)
+			return &tokens[i];
+	}
+	return NULL;
+}
+
+// Consume the operator s if it's next.
+static int accept(struct arith_parser *ap, const char *s) {
+	const struct arith_token *t = peek_token(ap);
+	if (t == NULL || strcmp(t->text, s) != 0)
+		return 0;
+	ap->p += strlen(s);
+	return 1;
+}
+
+static struct arith *syntax_error(struct arith_parser *ap) {
+	if (!ap->failed)
+		fprintf(stderr, "%s: syntax error at '%s'\n", ap->text, *ap->p ? ap->p : "end of expression");
+	ap->failed = 1;
+	return NULL;
+}
+
+static struct arith *new_node(struct arith_parser *ap, enum arith_op op, struct arith *left, struct arith *right) {
+	struct arith *a = arena_alloc(ap->arena, sizeof(struct arith));
+	a->op = op;
+	a->left = left;
+	a->right = right;
+	return a;
+}
+
+// The length of the variable name at s, 0 if there isn't one.
+static size_t name_len(const char *s) {
+	size_t n = 0;
+	if (isalpha((unsigned char)*s) || *s == '_') {
+		while (isalnum((unsigned char)s[n]) || s[n] == '_')
+			n++;
+	}
+	return n;
+}
+
+static struct arith *new_var(struct arith_parser *ap, const char *name, size_t len) {
+	struct arith *a = new_node(ap, A_VAR, NULL, NULL);
+	a->name = arena_strndup(ap->arena, name, len);
+	a->slot = context_var_slot(ap->context, a->name);
+	return a;
+}
+
+static struct arith *parse_comma(struct arith_parser *ap);
+static struct arith *parse_assign(struct arith_parser *ap);
+static struct arith *parse_unary(struct arith_parser *ap);
+
+static struct arith *parse_primary(struct arith_parser *ap) {
+	skip_space(ap);
+	const char *s = ap->p;
+	if (isdigit((unsigned char)*s)) {
+		// strtoll()'s base 0 reads 0x1f as hex and 017 as octal, as sh does.
+		char *end;
+		errno = 0;
+		struct arith *a = new_node(ap, A_NUM, NULL, NULL);
+		a->value = strtoll(s, &end, 0);
+		if (errno != 0 || isalnum((unsigned char)*end) || *end == '_')
+			return syntax_error(ap);
+		ap->p = end;
+		return a;
+	}
+	if (*s == '$' && s[1] == '?') {
+		ap->p += 2;
+		return new_var(ap, "?", 1);
+	}
+	size_t len = name_len(s + (*s == '$'));
+	if (len > 0) {
+		ap->p += len + (*s == '$');
+		return new_var(ap, s + (*s == '$'), len);
+	}
+	if (accept(ap, "(")) {
+		struct arith *a = parse_comma(ap);
+		if (a == NULL || !accept(ap, ")"))
+			return syntax_error(ap);
+		return a;
+	}
+	return syntax_error(ap);
+}
+
+static struct arith *parse_postfix(struct arith_parser *ap) {
+	struct arith *a = parse_primary(ap);
+	if (a == NULL || a->op != A_VAR || a->slot == 0)
+		return a;
+	if (accept(ap, "++"))
+		return new_node(ap, A_POSTINC, a, NULL);
+	if (accept(ap, "--"))
+		return new_node(ap, A_POSTDEC, a, NULL);
+	return a;
+}
+
+static struct arith *parse_unary(struct arith_parser *ap) {
+	static const struct { const char *text; enum arith_op op; } unary[] = {
+		{ "++", A_PREINC }, { "--", A_PREDEC }, { "-", A_NEG }, { "+", A_PLUS }, { "!", A_NOT }, { "~", A_BITNOT },
+	};
+	for (size_t i = 0; i < sizeof(unary) / sizeof(unary[0]); i++) {
+		if (!accept(ap, unary[i].text))
+			continue;
+		struct arith *operand = parse_unary(ap);
+		if (operand == NULL)
+			return NULL;
+		if ((unary[i].op == A_PREINC || unary[i].op == A_PREDEC) && (operand->op != A_VAR || operand->slot == 0))
+			return syntax_error(ap);
+		return new_node(ap, unary[i].op, operand, NULL);
+	}
+	return parse_postfix(ap);
+}
+
+// Binary operators binding at least as tightly as min_prec, by precedence climbing.
+static struct arith *parse_binary(struct arith_parser *ap, int min_prec) {
+	struct arith *left = parse_unary(ap);
+	while (left != NULL) {
+		const struct arith_token *t = peek_token(ap);
+		if (t == NULL || t->prec < min_prec || t->prec == 0 || t->assign)
+			break;
+		ap->p += strlen(t->text);
+		// ** groups to the right, everything else to the left.
+		struct arith *right = parse_binary(ap, t->op == A_POW ? t->prec : t->prec + 1);
+		if (right == NULL)
+			return NULL;
+		left = new_node(ap, t->op, left, right);
+	}
+	return left;
+}
+
+static struct arith *parse_conditional(struct arith_parser *ap) {
+	struct arith *cond = parse_binary(ap, 1);
+	if (cond == NULL || !accept(ap, "?"))
+		return cond;
+	struct arith *if_true = parse_comma(ap);
+	if (if_true == NULL || !accept(ap, ":"))
+		return syntax_error(ap);
+	struct arith *if_false = parse_assign(ap);
+	if (if_false == NULL)
+		return NULL;
+	struct arith *a = new_node(ap, A_COND, if_true, if_false);
+	a->cond = cond;
+	return a;
+}
+
+static struct arith *parse_assign(struct arith_parser *ap) {
+	skip_space(ap);
+	const char *start = ap->p;
+	size_t len = name_len(start);
+	if (len > 0) {
+		ap->p += len;
+		const struct arith_token *t = peek_token(ap);
+		if (t != NULL && t->assign) {
+			ap->p += strlen(t->text);
+			struct arith *value = parse_assign(ap);
+			if (value == NULL)
+				return NULL;
+			struct arith *a = new_node(ap, A_ASSIGN, new_var(ap, start, len), value);
+			a->assign_op = t->op;
+			return a;
+		}
+		ap->p = start;
+	}
+	return parse_conditional(ap);
+}
+
+static struct arith *parse_comma(struct arith_parser *ap) {
+	struct arith *a = parse_assign(ap);
+	while (a != NULL && accept(ap, ",")) {
+		struct arith *right = parse_assign(ap);
+		a = right ? new_node(ap, A_COMMA, a, right) : NULL;
+	}
+	return a;
+}
+
+// Parse text, allocating from arena. Returns NULL, having said why, if it isn't a valid
+// expression. An empty one is 0, as in sh.
+struct arith *parse_arith(struct context *context, struct arena *arena, const char *text) {
+	struct arith_parser ap = { context, arena, text, text, 0 };
+	skip_space(&ap);
+	if (*ap.p == 0) {
+		struct arith *zero = new_node(&ap, A_NUM, NULL, NULL);
+		zero->text = text;
+		return zero;
+	}
+	struct arith *a = parse_comma(&ap);
+	skip_space(&ap);
+	if (a != NULL && *ap.p != 0)
+		return syntax_error(&ap);
+	if (ap.failed)
+		return NULL;
+	a->text = text;
+	return a;
+}
+
+static int fail(const char **error, const char *why) {
+	*error = why;
+	return -1;
+}
+
+static int var_value(struct context *context, const struct arith *var, long long *value, const char **error) {
+	const char *s = var->slot ? context_get_slot(context, var->slot) : context_get_var(context, var->name);
+	while (s != NULL && isspace((unsigned char)*s))
+		s++;
+	if (s == NULL || *s == 0) {
+		*value = 0;
+		return 0;
+	}
+	char *end;
+	errno = 0;
+	*value = strtoll(s, &end, 0);
+	while (isspace((unsigned char)*end))
+		end++;
+	if (errno != 0 || *end != 0)
+		return fail(error, "variable value is not a number");
+	return 0;
+}
+
+static void set_var_value(struct context *context, const struct arith *var, long long value) {
+	char buf[24];
+	snprintf(buf, sizeof(buf), "%lld", value);
+	context_set_slot(context, var->slot, buf);
+}
+
+// a op b, for the binary operators. Overflow wraps, as it does in sh, rather than being
+// undefined.
+static int binary(enum arith_op op, long long a, long long b, long long *result, const char **error) {
+	unsigned long long ua = a, ub = b;
+	switch (op) {
+	case A_POW:
+		if (b < 0)
+			return fail(error, "exponent less than 0");
+		*result = 1;
+		for (unsigned long long r = 1; b > 0; b >>= 1, ua *= ua) {
+			if (b & 1)
+				r *= ua;
+			*result = r;
+		}
+		return 0;
+	case A_MUL: *result = (long long)(ua * ub); return 0;
+	case A_DIV:
+	case A_MOD:
+		if (b == 0)
+			return fail(error, "division by 0");
+		if (b == -1)	// LLONG_MIN / -1 overflows.
+			*result = op == A_DIV ? (long long)(0 - ua) : 0;
+		else
+			*result = op == A_DIV ? a / b : a % b;
+		return 0;
+	case A_ADD: *result = (long long)(ua + ub); return 0;
+	case A_SUB: *result = (long long)(ua - ub); return 0;
+	case A_SHL: *result = (long long)(ua << (b & 63)); return 0;
+	case A_SHR: *result = a >> (b & 63); return 0;
+	case A_LT: *result = a < b; return 0;
+	case A_LE: *result = a <= b; return 0;
+	case A_GT: *result = a > b; return 0;
+	case A_GE: *result = a >= b; return 0;
+	case A_EQ: *result = a == b; return 0;
+	case A_NE: *result = a != b; return 0;
+	case A_BAND: *result = a & b; return 0;
+	case A_BXOR: *result = a ^ b; return 0;
+	case A_BOR: *result = a | b; return 0;
+	default: return fail(error, "bad operator");
+	}
+}
+
+static int eval(struct context *context, const struct arith *a, long long *result, const char **error) {
+	long long l, r;
+	switch (a->op) {
+	case A_NUM:
+		*result = a->value;
+		return 0;
+	case A_VAR:
+		return var_value(context, a, result, error);
+	case A_NEG:
+	case A_PLUS:
+	case A_NOT:
+	case A_BITNOT:
+		if (eval(context, a->left, &l, error) == -1)
+			return -1;
+		*result = a->op == A_NEG ? (long long)(0 - (unsigned long long)l) : a->op == A_PLUS ? l : a->op == A_NOT ? !l : ~l;
+		return 0;
+	case A_PREINC:
+	case A_PREDEC:
+	case A_POSTINC:
+	case A_POSTDEC:
+		if (var_value(context, a->left, &l, error) == -1)
+			return -1;
+		r = (long long)((unsigned long long)l + (a->op == A_PREINC || a->op == A_POSTINC ? 1 : -1));
+		set_var_value(context, a->left, r);
+		*result = a->op == A_PREINC || a->op == A_PREDEC ? r : l;
+		return 0;
+	case A_AND:
+	case A_OR:
+		if (eval(context, a->left, &l, error) == -1)
+			return -1;
+		if ((a->op == A_AND) == !l) {
+			*result = a->op == A_OR;	// Decided by the left side.
+			return 0;
+		}
+		if (eval(context, a->right, &r, error) == -1)
+			return -1;
+		*result = r != 0;
+		return 0;
+	case A_COND:
+		if (eval(context, a->cond, &l, error) == -1)
+			return -1;
+		return eval(context, l ? a->left : a->right, result, error);
+	case A_ASSIGN:
+		if (eval(context, a->right, &r, error) == -1)
+			return -1;
+		if (a->assign_op != A_ASSIGN) {
+			if (var_value(context, a->left, &l, error) == -1 || binary(a->assign_op, l, r, &r, error) == -1)
+				return -1;
+		}
+		set_var_value(context, a->left, r);
+		*result = r;
+		return 0;
+	case A_COMMA:
+		if (eval(context, a->left, &l, error) == -1)
+			return -1;
+		return eval(context, a->right, result, error);
+	default:
+		if (eval(context, a->left, &l, error) == -1 || eval(context, a->right, &r, error) == -1)
+			return -1;
+		return binary(a->op, l, r, result, error);
+	}
+}
+
+// Evaluate a, as returned by parse_arith(), into *result. Returns -1, having said why, on an
+// error like division by 0.
+int eval_arith(struct context *context, const struct arith *a, long long *result) {
+	const char *error;
+	if (eval(context, a, result, &error) == 0)
+		return 0;
+	fprintf(stderr, "%s: %s\n", a->text, error);
+	return -1;
+}
+
+// Whether evaluating a sets a variable, e.g. $((i++)).
+int arith_assigns(const struct arith *a) {
+	if (a == NULL)
+		return 0;
+	if (a->op == A_ASSIGN || a->op == A_PREINC || a->op == A_PREDEC || a->op == A_POSTINC || a->op == A_POSTDEC)
+		return 1;
+	return arith_assigns(a->left) || arith_assigns(a->right) || arith_assigns(a->cond);
+}
+
+// let expression ...: evaluate each, succeeding if the last isn't 0.
+int builtin_let(struct context *context, char **argv, int argc) {
+	if (argc < 2) {
+		fprintf(stderr, "let: expression expected\n");
+		return 1;
+	}
+	long long value = 0;
+	void *mark = arena_alloc(&context->scratch, 0);
+	for (int i = 1; i < argc; i++) {
+		struct arith *a = parse_arith(context, &context->scratch, argv[i]);
+		if (a == NULL || eval_arith(context, a, &value) == -1) {
+			arena_release(&context->scratch, mark);
+			return 1;
+		}
+	}
+	arena_release(&context->scratch, mark);
+	return value == 0;
+}
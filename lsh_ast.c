@@ -1,5 +1,7 @@
 // Functions you need to implement are labeled below
 
+#define _GNU_SOURCE	// pipe2()
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -7,53 +9,14 @@
 #include <search.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <spawn.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 #include "lsh_ast.h"
 
-// Forward declarations.
-/*static*/ void context_pid_wait_tree_add(struct context *context, int pid);
-/*static*/ void context_empty_pid_wait_tree(struct context *context);
-
-static int _env_tree_compare(const char *a, const char *b) {
-	while (1) {
-		if (a == b) return 0;
-		int adone = a == 0 || *a == 0 || *a == '=';
-		int bdone = b == 0 || *b == 0 || *b == '=';
-		if (adone && bdone) return 0;
-		if (bdone) return -1;
-		if (adone) return 1;
-		if (*a < *b) return -1;
-		if (*a > *b) return 1;
-		a++; b++;
-	}
-}
-
-int env_tree_compare(const void *a, const void *b) {
-	int rc = _env_tree_compare(a, b);
-	return rc;
-}
-
-int pid_wait_tree_compare(const void *a, const void *b) {
-	uintptr_t ap = (uintptr_t)a;
-	uintptr_t bp = (uintptr_t)b;
-	if (ap < bp) return -1;
-	else if (ap == bp) return 0;
-	else return -1;
-}
-
-void tsearch_print_env_tree(const void *nodep, VISIT which, int depth)
-{
-	const char *datap;
-	(void)depth;
-	datap = *(const char **) nodep;
-	if (which == postorder || which == leaf) {
-		printf("%d %p %s\n", which, nodep, datap);
-	}
-}
-
-
 void space(FILE *f, int depth) {
 	for (int i = 0; i < depth; i++)
 		fprintf(f, "  ");
@@ -110,6 +73,15 @@ void print_for_loop(FILE *f, const struct for_loop *for_loop, int depth) {
 	print_script(f, for_loop->script, depth + 1);
 }
 
+void print_while_loop(FILE *f, const struct while_loop *while_loop, int depth) {
+	space(f, depth);
+	fprintf(f, "%s:\n", while_loop->until ? "until" : "while");
+	print_pipe_stream(f, while_loop->predicate, depth + 1);
+	space(f, depth);
+	fprintf(f, "do:\n");
+	print_script(f, while_loop->script, depth + 1);
+}
+
 void print_var_assign(FILE *f, const struct var_assign *var_assign, int depth) {
 	space(f, depth);
 	fprintf(f, "var_assign: %s = ", var_assign->var_name);
@@ -121,6 +93,9 @@ void print_statement(FILE *f, const struct statement *statement, int depth) {
 	if (statement->for_loop != NULL) {
 		print_for_loop(f, statement->for_loop, depth);
 	}
+	if (statement->while_loop != NULL) {
+		print_while_loop(f, statement->while_loop, depth);
+	}
 	if (statement->conditional != NULL) {
 		print_conditional(f, statement->conditional, depth);	
 	}
@@ -140,203 +115,222 @@ void print_script(FILE *f, const struct script *script, int depth) {
 	}
 }
 
-#define FREE_LL(t, x)	do { struct t *p = x->first; while (p) { struct t *next = p->next; free_##t(p); p = next; } } while(0)
-
-void free_word(struct word *word) {
-	free((void *) word->text);
-	free(word);
-}
-
-void free_words(struct words *words) {
-	FREE_LL(word, words);
-	free(words);
-}
-
-void free_program(struct program *program) {
-	free_words(program->words);
-	free(program);
-}
-
-void free_pipe_stream(struct pipe_stream *pipe_stream) {
-	FREE_LL(program, pipe_stream);
-	free(pipe_stream);
-}
-
-void free_for_loop(struct for_loop *for_loop) {
-	free_word(for_loop->var_name);
-	free_words(for_loop->var_values);
-	free_script(for_loop->script);
-	free(for_loop);
-}
-
-void free_var_assign(struct var_assign *var_assign) {
-	free((void *)var_assign->var_name);
-	free_words(var_assign->var_value);
-	free(var_assign);
-}
-
-void free_statement(struct statement *statement) {
-	if (statement->for_loop)
-		free_for_loop(statement->for_loop);
-	if (statement->conditional)
-		free_conditional(statement->conditional);
-	if (statement->pipe_stream)
-		free_pipe_stream(statement->pipe_stream);
-	if (statement->var_assign)
-		free_var_assign(statement->var_assign);
-	free(statement);
-}
-
-void free_script(struct script *script) {
-	FREE_LL(statement, script);
-	free(script);
-}
-
-void free_conditional_part(struct conditional_part *conditional_part) {
-	free_pipe_stream(conditional_part->predicate);
-	free_script(conditional_part->if_true_block);
-	free(conditional_part);
-}
-
-void free_conditional(struct conditional *conditional) {
-	FREE_LL(conditional_part, conditional);
-	if (conditional->else_block)
-		free_script(conditional->else_block);
-	free(conditional);
-}
-
-static void context_empty_env_tree(struct context *context) {
-	while (context->env_tree != NULL) {
-		const char *e = *(const char **)context->env_tree;
-		tdelete(e, &context->env_tree, env_tree_compare);
-		free((void *)e);
-	}
+// The script and everything it points to live in the parse arena, drop them all at once.
+void free_script(struct context *context) {
+	context->script = NULL;
+	arena_reset(&context->arena);
 }
 
 void free_context(struct context *context) {
-	context_empty_env_tree(context);
-	context_empty_pid_wait_tree(context);
+	arena_free(&context->arena);
+	arena_free(&context->scratch);
+	free_plan(&context->plan);
+	context_free_vars(context);
+	path_cache_clear(context);
+	glob_cache_free(context);
+	stat_cache_free(context);
+	read_buffer_free(context);
+	jobs_free(context);
+	trace_close(context);
 	free(context);
 }
 
-static struct argv_buf *argv_buf_expand(struct argv_buf *buf) {
-	buf->capacity <<= 1;
-	struct argv_buf *ret = realloc(buf, sizeof(*buf) + buf->capacity);
-	if (ret == NULL) {
-		fprintf(stderr, "realloc() failed for argv_buf!\n");
-		exit(1);
+// Split s on whitespace, as an unquoted variable expansion is. Returns the number of
+// fields and adds their total size (each with a NUL) to *bytes.
+static int count_fields(const char *s, size_t *bytes) {
+	int n = 0;
+	for (const char *p = s; *p; ) {
+		while (isspace((unsigned char)*p)) p++;
+		if (*p == 0)
+			break;
+		const char *start = p;
+		while (*p && !isspace((unsigned char)*p)) p++;
+		*bytes += p - start + 1;
+		n++;
 	}
-	return ret;
-}
-
-// Add a single char to the argv buf, expanding if needed.
-static struct argv_buf *argv_buf_putchar(struct argv_buf *buf, char c) {
-	if (buf->used >= buf->capacity - 1) {
-		buf = argv_buf_expand(buf);
+	return n;
+}
+
+// Copy the fields of s into argv/strings, returning the next free argv slot.
+static char **copy_fields(const char *s, char **argv, char **strings) {
+	for (const char *p = s; *p; ) {
+		while (isspace((unsigned char)*p)) p++;
+		if (*p == 0)
+			break;
+		const char *start = p;
+		while (*p && !isspace((unsigned char)*p)) p++;
+		size_t len = p - start;
+		memcpy(*strings, start, len);
+		(*strings)[len] = 0;
+		*argv++ = *strings;
+		*strings += len + 1;
 	}
-	buf->buf[buf->used++] = c;
-	return buf;
+	return argv;
 }
 
-// Add an entire string to the argv buf plus a null terminator, expanding if needed.
-static struct argv_buf *argv_buf_puts(struct argv_buf *buf, const char *s) {
-	for (const char *c = s; c && *c; c++)
-		buf = argv_buf_putchar(buf, *c);
-	buf = argv_buf_putchar(buf, 0);
-	return buf;
+// Copy s into strings as the next argument, returning the next free argv slot.
+static char **copy_arg(const char *s, char **argv, char **strings) {
+	size_t len = strlen(s);
+	memcpy(*strings, s, len + 1);
+	*argv++ = *strings;
+	*strings += len + 1;
+	return argv;
 }
 
-struct argv_buf *make_argv(const struct context *context, const struct words *words) {
-	struct argv_buf *buf = malloc(sizeof(*buf));
-	buf->argv = 0;
-	buf->argc = 0;
-	buf->used = 0;
-	buf->capacity = sizeof(buf->buf);
+// What a word that isn't literal expanded to, worked out once while sizing an argv and used
+// again to fill it in.
+struct expansion {
+	const char *fields;		// A variable's value or a command's output, split on whitespace.
+	char *output;			// The command's output, malloc'd.
+	char number[24];		// An arithmetic expression's value.
+	struct glob_matches matches;	// A pattern's matches.
+};
+
+// The variables already expanded point at their values, which running a command or setting a
+// variable could change or free, so take copies of them before doing either.
+static void expansions_copy_vars(struct expansion *expansions, int n) {
+	for (int i = 0; i < n; i++) {
+		struct expansion *e = &expansions[i];
+		if (e->fields != NULL && e->output == NULL && e->fields != e->number)
+			e->fields = e->output = strdup(e->fields);
+	}
+}
 
+// Expand words into an argv, in a single allocation from arena: the argv_buf, the argv
+// array and the strings it points at. Literal words are one argument each, variables and
+// $(...) are split on whitespace, $((...)) is its value, and patterns become the paths they
+// match (or stay as they are if nothing matches). If an expression can't be evaluated, the
+// argv is marked failed. The size is computed first so everything is copied exactly once.
+// Literal words aren't copied at all: their slots point at the word's text, which lives as
+// long as the script, so only the positions that expand are filled in per run.
+// Runtime callers pass the context's scratch arena and free_argv() the result when done,
+// so in the steady state building an argv of literals and variables doesn't touch malloc.
+struct argv_buf *make_argv(struct context *context, struct arena *arena, const struct words *words) {
+	struct expansion local_expansions[16];
+	struct expansion *expansions = local_expansions;
+	int nexpansions = 0;
+	int capacity = sizeof(local_expansions) / sizeof(local_expansions[0]);
+
+	int argc = 0, failed = 0;
+	size_t bytes = 0;
 	for (const struct word *word = words->first; word != NULL; word = word->next) {
-		if (word->is_var) {
-			const char *var = context_get_var(context, word->text);
-			if (var) {
-				buf = argv_buf_puts(buf, var);	// FIXME
+		if (word_is_literal(word)) {
+			argc++;
+			continue;
+		}
+		if (nexpansions == capacity) {
+			capacity *= 2;
+			if (expansions == local_expansions) {
+				expansions = malloc(capacity * sizeof(struct expansion));
+				memcpy(expansions, local_expansions, sizeof(local_expansions));
+			} else {
+				expansions = realloc(expansions, capacity * sizeof(struct expansion));
 			}
+		}
+		struct expansion *e = &expansions[nexpansions++];
+		memset(e, 0, sizeof(*e));
+		if (word->is_var) {
+			e->fields = word_var_value(context, word);
+		} else if (word->cmdsub) {
+			int rc;
+			expansions_copy_vars(expansions, nexpansions - 1);
+			e->fields = e->output = run_command_subst(context, word, &rc);
+		} else if (word->arith) {
+			if (arith_assigns(word->arith))
+				expansions_copy_vars(expansions, nexpansions - 1);
+			long long value = 0;
+			if (eval_arith(context, word->arith, &value) == -1)
+				failed = 1;
+			snprintf(e->number, sizeof(e->number), "%lld", value);
+			e->fields = e->number;
 		} else {
-			buf = argv_buf_puts(buf, word->text);
+			glob_expand(context, word->text, &e->matches);
+			for (int i = 0; i < e->matches.count; i++)
+				bytes += strlen(e->matches.paths[i]) + 1;
+			argc += e->matches.count;
+			if (e->matches.count == 0) {
+				argc++;
+				bytes += strlen(word->text) + 1;
+			}
 		}
+		if (e->fields)
+			argc += count_fields(e->fields, &bytes);
 	}
 
-	// Argv in a separate allocation, for pointer stability of the underlying string
-	// data if a vector expansion occurs due to argv.
-	int max_argc = 2;
-	buf->argv = malloc(sizeof(char *) * (max_argc + 1));
-
-	int in_word = 0;
-	for (size_t i = 0; i < buf->used; i++) {
-		char *c = &buf->buf[i];
-		if (buf->argc == max_argc - 1) {
-			max_argc <<= 1;
-			buf->argv = realloc(buf->argv, sizeof(char *) * (max_argc + 1));
-		}
-		if (!in_word && !isspace(*c) && *c != 0) {
-			in_word = 1;
-			buf->argv[buf->argc++] = c;
-		} else if (in_word && (isspace(*c) || *c == 0)) {
-			in_word = 0;
-			*c = 0;	// convert spaces to null termination for argv.
-		} else if (!in_word) {
-			*c = 0;
+	size_t argv_size = sizeof(struct argv_buf) + (argc + 1) * sizeof(char *);
+	struct argv_buf *buf = arena_alloc(arena, argv_size + bytes);
+	char **argv = buf->argv;
+	char *strings = (char *)buf + argv_size;
+	const struct expansion *e = expansions;
+	for (const struct word *word = words->first; word != NULL; word = word->next) {
+		if (word_is_literal(word)) {
+			*argv++ = (char *)word->text;
+		} else if (e->fields) {
+			argv = copy_fields(e++->fields, argv, &strings);
+		} else if (e->matches.count > 0) {
+			for (int i = 0; i < e->matches.count; i++)
+				argv = copy_arg(e->matches.paths[i], argv, &strings);
+			e++;
+		} else {
+			if (word->is_glob)
+				argv = copy_arg(word->text, argv, &strings);
+			e++;
 		}
 	}
-	buf->argv[buf->argc] = NULL;
+	*argv = NULL;
+	buf->argc = argc;
+	buf->failed = failed;
+
+	for (int i = 0; i < nexpansions; i++) {
+		free(expansions[i].output);
+		glob_matches_free(&expansions[i].matches);
+	}
+	if (expansions != local_expansions)
+		free(expansions);
 	return buf;
 }
 
-void free_argv(struct argv_buf *buf) {
-	if (buf->argv) free(buf->argv);
-	free(buf);
+// Release an argv from make_argv(), and anything allocated from the scratch arena after it.
+void free_argv(struct context *context, struct argv_buf *buf) {
+	arena_release(&context->scratch, buf);
 }
 
-void run_conditional(struct context *context, const struct conditional *conditional) {
-	for (const struct conditional_part *cp = conditional->first; cp != NULL; cp = cp->next) {
-		int rc = run_pipe_stream(context, cp->predicate);
-		if (rc == 0) {
-			// take this block and return.
-			run_script(context, cp->if_true_block);
-			return;
-		}
+// Convert a waitpid() status into a shell return code.
+int wait_status_rc(pid_t pid, int status) {
+	if (WIFEXITED(status)) {
+		return WEXITSTATUS(status);
+	} else if (WIFSIGNALED(status)) {
+		printf("Child %d terminated by signal %d\n", pid, WTERMSIG(status));
 	}
-	if (conditional->else_block != NULL) {
-		run_script(context, conditional->else_block);
+	return -1;
+}
+
+// The value is a single word and, like in sh, isn't split, so no argv is needed. The status
+// is that of the $(...) in the value, if there is one.
+int run_var_assign(struct context *context, const struct var_assign *var_assign) {
+	const struct word *word = var_assign->var_value->first;
+	const char *value = "";
+	int rc = 0;
+	if (word != NULL && word->cmdsub) {
+		char *output = run_command_subst(context, word, &rc);
+		context_set_slot(context, var_assign->slot, output);
+		free(output);
+		return rc;
 	}
-}
-
-void run_for_loop(struct context *context, const struct for_loop *for_loop) {
-	struct argv_buf *buf = make_argv(context, for_loop->var_values);
-
-	for (int i = 0; i < buf->argc; i++) {
-		context_set_var(context, for_loop->var_name->text, buf->argv[i]);
-		run_script(context, for_loop->script);
+	if (word != NULL && word->arith) {
+		long long n;
+		char number[24];
+		if (eval_arith(context, word->arith, &n) == -1)
+			return 1;
+		snprintf(number, sizeof(number), "%lld", n);
+		context_set_slot(context, var_assign->slot, number);
+		return rc;
 	}
+	if (word != NULL)
+		value = word->is_var ? word_var_value(context, word) : word->text;
 
-	free_argv(buf);
-}
-
-void run_var_assign(struct context *context, const struct var_assign *var_assign) {
-	struct argv_buf *buf = make_argv(context, var_assign->var_value);
-
-	context_set_var(context, var_assign->var_name, buf->argv[0]);
-
-	free_argv(buf);
-}
-
-void run_fg_statement(struct context *context, const struct statement *statement) {
-	if (statement->conditional)
-		run_conditional(context, statement->conditional);
-	if (statement->pipe_stream)
-		run_pipe_stream(context, statement->pipe_stream);
-	if (statement->for_loop)
-		run_for_loop(context, statement->for_loop);
-	if (statement->var_assign)
-		run_var_assign(context, statement->var_assign);
+	context_set_slot(context, var_assign->slot, value);
+	return rc;
 }
 
 /******************************************************************************************************
@@ -346,165 +340,94 @@ void run_fg_statement(struct context *context, const struct statement *statement
  ******************************************************************************************************/
 
 
-/*static*/ void context_pid_wait_tree_add(struct context *context, int pid) {
-	tsearch((void*)(uintptr_t)pid, &context->pid_wait_tree, pid_wait_tree_compare);
-}
-
-struct pid_list {
-   pid_t pid; // The PID being stored in this node of the list
-   struct pid_list *next; // Pointer to the next node in the linked list
-};
-
- void collect_pids(const void *nodep, const VISIT which) {
-    static struct pid_list *head = NULL;  // keeps track of the head of the linked list
-    static struct pid_list *current = NULL;  // keeps track of the current node in the linked list
-
-    // Dereference nodep to get the PID value
-    pid_t pid = *((pid_t *) nodep);  // Assuming nodep is a pointer to pid_t
-
-    // Check the visit type to find out what the action is
-    // VISIT enum values indicate when to perform actions in tree traversal
-    if (which == postorder || which == leaf) {
-        // Allocate memory for a new node in the linked list
-        struct pid_list *new_node = malloc(sizeof(struct pid_list));
-	// Initialize the new node with the PID and set its next pointer to NUL
-        new_node->pid = pid;
-        new_node->next = NULL;
-
-	// If the list is empty, initialize the head and current pointers to the new node
-        if (head == NULL) {
-            head = new_node;
-            current = new_node;
-        } else {
-	    // append the new node to the end of the list
-            current->next = new_node;
-            current = new_node;
-        }
-    }
-}
-
-/*static*/ void context_empty_pid_wait_tree(struct context *context) {
-	// This loop will iterate through all pids inserted into pid_wait_tree.
-	while (context->pid_wait_tree != NULL) {
-	        // Extract the PID from the tree node
-	        // Dereference the void pointer to get the integer value of the PID
-		int pid = *(int *)context->pid_wait_tree;
-		// Remove the PID from the pid_wait_tree
-		// Convert the PID integer to a void pointer for the tree function
-		tdelete((void *)(uintptr_t)pid, &context->pid_wait_tree, pid_wait_tree_compare);
-		// Wait on the child process with process id 'pid'.
-	        // Wait for the child process with process id 'pid'.
-		int status;
-		// Call waitpid to wait for the child process with the given PID
-		if (waitpid(pid, &status, 0) == -1) {
-		  perror("waitpid");
-		  // Handle the error continuing with other processes
-		} else {
-		  // Check the status of the child process to determine how it terminated
-		  // returns true if the child process terminated normally
-		  if (WIFEXITED(status)) {
-		    // Print the PID and exit status of the child process
-		    printf("Child %d exited with status %d\n", pid, WEXITSTATUS(status));
-		    // Returns true if the child process was terminated by a signal
-		  } else if (WIFSIGNALED(status)) {
-		    // Print the PID and the signal number that caused the termination
-		    printf("Child %d terminated by signal %d\n", pid, WTERMSIG(status));
-		  }
+// Launch argv as a child process with stdin/stdout replaced by in_fd/out_fd (-1 to inherit),
+// and then redirects (may be NULL) applied.
+// pgid puts the child in a process group: 0 for a new one led by the child, -1 to stay in ours.
+// This uses posix_spawn(), which glibc implements with clone(CLONE_VM|CLONE_VFORK), so the
+// cost doesn't grow with the size of the shell's address space like fork() does. The pipe
+// plumbing and redirections a forked child would do by hand are expressed as spawn file
+// actions instead.
+// argv[0] is resolved through the PATH cache rather than having exec walk $PATH.
+// Returns the child's pid, -1 if it could not be started, or -2 if a redirection failed.
+pid_t spawn_program(struct context *context, char **argv, int in_fd, int out_fd, const struct redirects *redirects, pid_t pgid) {
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (in_fd != -1)
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	if (out_fd != -1)
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+
+	// Like sh, redirections happen before the command is looked up: `nosuchcmd > f` creates f.
+	int *fds = NULL;
+	int nfds = 0;
+	if (redirects != NULL) {
+		fds = arena_alloc(&context->scratch, redirects_count(redirects) * sizeof(int));
+		nfds = redirect_file_actions(context, redirects, &actions, fds);
+		if (nfds == -1) {
+			arena_release(&context->scratch, fds);
+			posix_spawn_file_actions_destroy(&actions);
+			return -2;
 		}
 	}
-}
-
-// Determines if the given command (string) is an intrinsic command (see sections 3 and 4)
-// Return 1 if the command is an intrinsic and 0 otherwise
-int is_builtin(const char *argv0) {
-	if (strcmp(argv0, "exit") == 0) return 1;
-	// Your code goes here (Sections 4 & 5)
-	// Check if the command is 'cd' (change directory)
-	if (strcmp(argv0, "cd") == 0) return 1;
-	
-	// Check if the command is 'jobs' (list background jobs)
-	if (strcmp(argv0, "jobs") == 0) return 1;
-	
-	if (strcmp(argv0, "help") == 0) return 1;
-	// return 0 if the command is not a built-in
-	return 0;
-}
-
-void print_pids(const void *nodep, const VISIT which, int depth) {
-    (void)depth;  // Suppress unused parameter warning
-
-    // Check the type of visit to determine if the function should process the current node.
-    // 'leaf' means the node is a leaf node in the tree.
-    // 'postorder' means the function should process the node after processing it's children
-    if (which == leaf || which == postorder) {
-        // Cast nodep to a pointer to struct pid_list *
-        // nodep is a pointer to a struct pid_list *
-        const struct pid_list *node = *(const struct pid_list **)nodep;
-	// Print the PID of the background job
-        printf("Background job: PID %d\n", node->pid);
-    }
-}
-
 
-// Handle an intrinsic command. See run_one_program for how this function will be used.
-// Takes in context, instrinsic command + arguments, and the length of argv
-// Hint: which system call can change the current working directory of a process?
-// Hint: the home directory is in the environment variable 'HOME'
-int handle_builtin(struct context *context, char **argv, int argc) {
-	if (strcmp(argv[0], "exit") == 0) {
-		exit(0);
-	}
-
-	// Your code goes here (Sections 4 & 5)
-	if (strcmp(argv[0], "cd") == 0) {
-	  // If no argument provided, go to the home directory
-	  if (argc < 2 || argv[1] == NULL) {
-	    const char *home = getenv("HOME");
-	    if (home == NULL) {
-               fprintf(stderr, "cd: HOME not set\n");
-               return EINVAL;  // Error if HOME is not set
-	    }
-            if (chdir(home) != 0) {
-               perror("cd");  // Print error if chdir fails
-               return errno;  // Return error code
-            }
-       } else {
-           // Change to the specified directory
-           if (chdir(argv[1]) != 0) {
-               perror("cd");  // Print error if chdir fails
-               return errno;  // Return error code
-           }
-       }
-       return 0;  // Return 0 on success
-   }
-   // Handle 'jobs'
-   if (strcmp(argv[0], "jobs") == 0) {
-        // List all background jobs stored in pid_wait_tree
-        if (context->pid_wait_tree == NULL) {
-            printf("No background jobs.\n");
-            return 0;
-        }
-
-	// traverse and print background jobs
-        twalk(context->pid_wait_tree, print_pids);
-        return 0;
-    }
-
-    // Handle 'help'
-    if (strcmp(argv[0], "help") == 0) {
-        printf("Built-in commands:\n");
-        printf("  exit: Exit the shell\n");
-        printf("  cd [dir]: Change the current directory to [dir]\n");
-        printf("  jobs: List background jobs\n");
-        printf("  help: Display this help message\n");
-        return 0;
-    }
+	pid_t pid = -1;
+	const char *path = path_cache_lookup(context, argv[0]);
+	if (path == NULL) {
+		fprintf(stderr, "%s: command not found\n", argv[0]);
+		goto out;
+	}
 
+	// The shell blocks SIGCHLD to read it from a signalfd, the program shouldn't inherit that.
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	short flags = 0;
+	if (context->jobs.watching) {
+		sigset_t mask;
+		sigemptyset(&mask);
+		posix_spawnattr_setsigmask(&attr, &mask);
+		flags |= POSIX_SPAWN_SETSIGMASK;
+	}
+	if (pgid != -1) {
+		posix_spawnattr_setpgroup(&attr, pgid);
+		flags |= POSIX_SPAWN_SETPGROUP;
+	}
+	posix_spawnattr_setflags(&attr, flags);
+
+	int err = posix_spawn(&pid, path, &actions, &attr, argv, context_envp(context));
+	if (err == ENOENT && path != argv[0]) {
+		// The cached executable went away, look it up again.
+		path_cache_forget(context, argv[0]);
+		path = path_cache_lookup(context, argv[0]);
+		err = path ? posix_spawn(&pid, path, &actions, &attr, argv, context_envp(context)) : ENOENT;
+	}
+	if (err == ENOEXEC) {
+		// Not a binary and no #!, run it as a shell script like execvp() would.
+		int argc = 0;
+		while (argv[argc] != NULL)
+			argc++;
+		char **sh_argv = arena_alloc(&context->scratch, (argc + 2) * sizeof(char *));
+		sh_argv[0] = (char *)"sh";
+		sh_argv[1] = (char *)path;
+		memcpy(sh_argv + 2, argv + 1, argc * sizeof(char *));
+		err = posix_spawn(&pid, "/bin/sh", &actions, &attr, sh_argv, context_envp(context));
+		arena_release(&context->scratch, sh_argv);
+	}
+	posix_spawnattr_destroy(&attr);
+	if (err != 0) {
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(err));
+		pid = -1;
+	}
 
-	return EINVAL;
+out:
+	// The child has its own copies of the redirected files.
+	while (nfds > 0)
+		close(fds[--nfds]);
+	if (fds != NULL)
+		arena_release(&context->scratch, fds);
+	posix_spawn_file_actions_destroy(&actions);
+	return pid;
 }
 
-
 // Run one command. If the command is an intrinsic (like 'cd'), it will be handled by handle_builtin.
 // Otherwise, you need to write code to handle it here in a child subprocess.
 // Hint: The shell (parent) needs to wait for the child to finish executing.
@@ -512,62 +435,243 @@ int run_one_program(struct context *context, const struct program *program) {
         // Declare a variable to hold the return code
 	int rc;
 	// Create an argument vector (argv)
-	// Converts the program's words into an array of arguments
-	struct argv_buf *argv = make_argv(context, program->words);
+	// Converts the program's words into an array of arguments, unless the plan already did.
+	struct argv_buf *argv = program->argv ? program->argv : make_argv(context, &context->scratch, program->words);
+
+	if (argv->failed) {
+		rc = 1;
+		goto out;
+	}
+	// Only test can rely on what test found out before it.
+	if (argv->argc == 0 || program->redirects != NULL || !is_test_builtin(argv->argv[0]))
+		stat_cache_clear(context);
+	// Nothing to run, e.g. a lone unset $VAR.
+	if (argv->argc == 0) {
+		rc = 0;
+		goto out;
+	}
 
 	// If this is a builtin, run it, otherwise, fork and exec.
 	if (is_builtin(argv->argv[0])) {
-		rc = handle_builtin(context, argv->argv, argv->argc);
+		if (program->redirects == NULL) {
+			rc = handle_builtin(context, argv->argv, argv->argc);
+			goto out;
+		}
+		// The builtin writes to the shell's own descriptors, so redirect those around it.
+		struct saved_fd *saved = arena_alloc(&context->scratch, redirects_count(program->redirects) * sizeof(struct saved_fd));
+		struct read_buffer input;
+		int nsaved;
+		int new_stdin = redirects_stdin(program->redirects);
+		if (new_stdin)
+			read_buffer_push(context, &input);
+		if (redirect_shell(context, program->redirects, saved, &nsaved) == 0)
+			rc = handle_builtin(context, argv->argv, argv->argc);
+		else
+			rc = 1;
+		redirect_restore(saved, nsaved);
+		if (new_stdin)
+			read_buffer_pop(context, &input);
+		arena_release(&context->scratch, saved);
 		goto out;
 	}
 
 	// Your code goes here (Section 3)
-	// Fork a child process to run the command
+	// Spawn a child process to run the command and wait for it.
+	fflush(NULL);	// Builtin output is buffered, write it before the child's.
+	pid_t pid = spawn_program(context, argv->argv, -1, -1, program->redirects, -1);
+	if (pid < 0) {
+		rc = pid == -2 ? 1 : 127;	// A failed redirection is 1, like sh.
+		goto out;
+	}
+	int status;
+	if (waitpid(pid, &status, 0) == -1) {
+		perror("waitpid");
+		rc = -1;
+	} else {
+		rc = wait_status_rc(pid, status);
+	}
+
+out:
+	// Clean up the argument vector
+	if (argv != program->argv)
+		free_argv(context, argv);
+	return rc;
+}
+
+static int pipe_stream_length(const struct pipe_stream *pipe_stream) {
+	int n = 0;
+	for (const struct program *p = pipe_stream->first; p != NULL; p = p->next)
+		n++;
+	return n;
+}
+
+// Open the file a leading `cat FILE` would copy, to be the next stage's stdin in its place.
+// Returns -1 if cat has to run after all: FILE is missing or isn't a regular file (cat's
+// error message and status are wanted), or under pipefail, where cat dying of SIGPIPE counts.
+static int open_pipe_stream_input(const struct context *context, const struct pipe_stream *pipe_stream) {
+	if (pipe_stream->input == NULL || context->pipefail)
+		return -1;
+	int fd = open(pipe_stream->input, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd != -1 && (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+// Run a builtin as a pipeline stage, e.g. the help in `help | head`. It can't run in the shell
+// itself while the other stages run alongside it, so it runs in a forked copy of the shell,
+// which calls the builtin directly instead of exec'ing anything. As in sh, a cd or exit there
+// only affects that copy.
+// in_fd, out_fd, redirects and pgid are as for spawn_program(). The child also closes
+// next_fd, the read end of its output pipe, since with no exec its close-on-exec doesn't apply.
+// Returns the child's pid, or -1 if it could not be started.
+static pid_t fork_builtin(struct context *context, struct argv_buf *argv, int in_fd, int out_fd, int next_fd, const struct redirects *redirects, pid_t pgid) {
 	pid_t pid = fork();
 	if (pid == -1) {
-        perror("fork");
-        rc = -1;
-        goto out;
-	}
-	if (pid == 0) { // Child process
-        // Execute the command using execvp
-        execvp(argv->argv[0], argv->argv);
-        // If execvp returns, it must have failed
-        perror("execvp");
-        exit(EXIT_FAILURE);
-    }  else { // Parent process
-        // Wait for the child process to complete
-        int status;
-        if (waitpid(pid, &status, 0) == -1) {
-            perror("waitpid");
-            rc = -1;
-        } else {
-            if (WIFEXITED(status)){
-	        // If the child process exited normally, get the exit status code
-                rc = WEXITSTATUS(status);
-            } else if (WIFSIGNALED(status)) {
-	      // If the child process was terminated by a signal, print a message with the signal number
-                printf("Child %d terminated by signal %d\n", pid, WTERMSIG(status));
-                rc = -1;
-            } else {
-	        // If the child process ended abnormally
-                rc = -1;
+		perror("fork");
+		return -1;
+	}
+	if (pid > 0) {
+		// Set the group from both sides, so it's in place whichever runs first.
+		if (pgid != -1)
+			setpgid(pid, pgid);
+		return pid;
+	}
+
+	if (pgid != -1)
+		setpgid(0, pgid);
+	if (in_fd != -1) {
+		dup2(in_fd, STDIN_FILENO);
+		close(in_fd);
+	}
+	if (out_fd != -1) {
+		dup2(out_fd, STDOUT_FILENO);
+		close(out_fd);
+	}
+	if (next_fd != -1)
+		close(next_fd);
+	// What the shell read ahead from its stdin isn't this stage's input if that was replaced.
+	if (in_fd != -1 || redirects_stdin(redirects))
+		read_buffer_free(context);
+	jobs_forget(context);
+	int rc = 1;
+	if (redirects == NULL) {
+		rc = handle_builtin(context, argv->argv, argv->argc);
+	} else {
+		struct saved_fd *saved = arena_alloc(&context->scratch, redirects_count(redirects) * sizeof(struct saved_fd));
+		int nsaved;
+		if (redirect_shell(context, redirects, saved, &nsaved) == 0)
+			rc = handle_builtin(context, argv->argv, argv->argc);
+	}
+	exit(rc & 0xff);
+}
+
+// Start every stage of the pipeline, connected by pipes, and store their pids in pids (-1 for
+// a stage that could not be started, -2 for one whose redirection failed, 0 for a `cat FILE`
+// that was replaced by opening FILE).
+// The last stage's stdout is last_out_fd, or the shell's if that's -1.
+// pgid is as for spawn_program(), except that with 0 the later stages join the first stage's
+// new group. If stages isn't NULL, each stage's pid and start time are recorded there too.
+static void spawn_pipe_stream(struct context *context, const struct pipe_stream *pipe_stream, pid_t *pids, int last_out_fd, pid_t pgid, struct stage_usage *stages) {
+    int pipe_fds[2];
+    int prev_fd = -1;  // Previous pipe's read end
+    const struct program *current_program = pipe_stream->first;
+    int n = pipe_stream_length(pipe_stream);
+
+    fflush(NULL);	// Builtin output is buffered, write it before the children's.
+    stat_cache_clear(context);
+    int i = 0;
+    if ((prev_fd = open_pipe_stream_input(context, pipe_stream)) != -1) {
+        // The second stage reads the file itself: one process and one copy fewer.
+        pids[0] = 0;
+        if (stages != NULL)
+            stages[0].start = trace_now();
+        i++;
+        current_program = current_program->next;
+    }
+    for (; i < n; i++, current_program = current_program->next) {
+        // Create a pipe to the next program. Both ends are close-on-exec: the child only
+        // keeps the copies its spawn file actions dup2() onto stdin/stdout.
+        int out_fd = current_program->next == NULL ? last_out_fd : -1;
+        pids[i] = -1;
+        if (current_program->next != NULL) {
+            if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+                perror("pipe");
+                // Reap what was started, the rest of the pipeline never runs.
+                for (int j = i + 1; j < n; j++)
+                    pids[j] = -1;
+                if (prev_fd != -1) close(prev_fd);
+                prev_fd = -1;
+                break;
             }
+            out_fd = pipe_fds[1];
         }
-    }
 
+        struct argv_buf *argv = current_program->argv;
+        if (argv == NULL)
+            argv = make_argv(context, &context->scratch, current_program->words);
+        if (stages != NULL)
+            stages[i].start = trace_now();
+        if (argv->failed)
+            pids[i] = -2;
+        else if (argv->argc == 0)
+            pids[i] = -1;
+        else if (is_builtin(argv->argv[0]))
+            pids[i] = fork_builtin(context, argv, prev_fd, out_fd, current_program->next != NULL ? pipe_fds[0] : -1, current_program->redirects, pgid);
+        else
+            pids[i] = spawn_program(context, argv->argv, prev_fd, out_fd, current_program->redirects, pgid);
+        if (stages != NULL)
+            stages[i].pid = pids[i];
+        if (pgid == 0 && pids[i] > 0)
+            pgid = pids[i];
+        if (argv != current_program->argv)
+            free_argv(context, argv);
+
+        // The parent's copies of the pipe ends now belong to the children.
+        if (out_fd != -1 && out_fd != last_out_fd) close(out_fd);
+        if (prev_fd != -1) close(prev_fd);
+        prev_fd = current_program->next != NULL ? pipe_fds[0] : -1;
+    }
+}
 
-out:
-	// Clean up the argument vector
-	free_argv(argv);
-	return rc;
+// Whether a pipeline can be spawned without a copy of the shell to run it, e.g. in the
+// background. Builtins have to run in the shell, and a $VAR or $(...) command name could turn
+// out to be one.
+int pipe_stream_spawnable(const struct pipe_stream *pipe_stream) {
+	for (const struct program *p = pipe_stream->first; p != NULL; p = p->next) {
+		const struct word *argv0 = p->words->first;
+		if (argv0->is_var || argv0->cmdsub || is_builtin(argv0->text))
+			return 0;
+	}
+	return 1;
 }
 
 // Run a command in the background (spawn as a child process but do not wait)
-// Note: need to keep track of all background child PIDs in case the user wants to call wait
-void run_bg_statement(struct context *context, const struct statement *statement) {
-    // Your code goes here (Section 5)
+// The statement is the plan's instructions [start, end). A plain pipeline is spawned
+// directly, in a process group of its own, so the job's pids are those of the programs
+// doing the work. Anything else runs in a forked copy of the shell. Either way the job is
+// tracked in the job table so wait and jobs can find it.
+void run_bg_statement(struct context *context, const struct statement *statement, int start, int end) {
+    if (statement->pipe_stream && pipe_stream_spawnable(statement->pipe_stream)) {
+        int n = pipe_stream_length(statement->pipe_stream);
+        pid_t *pids = arena_alloc(&context->scratch, n * sizeof(pid_t));
+        spawn_pipe_stream(context, statement->pipe_stream, pids, -1, 0, NULL);
+        int started = 0;
+        for (int i = 0; i < n; i++) {
+            if (pids[i] > 0)
+                pids[started++] = pids[i];
+        }
+        if (started > 0)
+            jobs_add(context, pids, started, statement_text(statement));
+        arena_release(&context->scratch, pids);
+        return;
+    }
+
     // Fork a child process to run the command
+    fflush(NULL);
+    stat_cache_clear(context);
     pid_t pid = fork();
     if (pid == -1) {
         perror("fork");
@@ -580,114 +684,115 @@ void run_bg_statement(struct context *context, const struct statement *statement
             exit(EXIT_FAILURE);
         }
         // Execute the command
-        run_fg_statement(context, statement);
-        exit(EXIT_SUCCESS);
-    } else { // Parent process
-       // Add the PID to the context's pid_wait_tree to track background processes
-        context_pid_wait_tree_add(context, pid);
-        printf("Started background job: PID %d\n", pid);
+        jobs_forget(context);
+        exit(run_plan(context, start, end) & 0xff);
     }
+    jobs_add(context, &pid, 1, statement_text(statement));
+}
+
+// A pipeline's status from its stages': the last stage's, or with pipefail the last failing stage's.
+static int pipe_stream_status(const struct context *context, const int *rcs, int n) {
+	int rc = 0;
+	for (int i = 0; i < n; i++) {
+		if (rcs[i] != 0 || !context->pipefail)
+			rc = rcs[i];
+	}
+	return rc;
+}
 
+// Record the status of each stage of the last pipeline in $PIPESTATUS, space separated, and
+// return the pipeline's status.
+static int context_set_pipestatus(struct context *context, const int *rcs, int n) {
+	char *text = arena_alloc(&context->scratch, n * 4);
+	char *p = text;
+	for (int i = 0; i < n; i++)
+		p += sprintf(p, "%s%d", i ? " " : "", rcs[i] & 0xff);
+	context_set_var(context, "PIPESTATUS", text);
+	arena_release(&context->scratch, text);
+	return pipe_stream_status(context, rcs, n);
 }
 
 // Execute the pipe stream of commands, which is two commands chained together with a pipe (|)
 // i.e. cat /usr/share/dict/words | grep ^z.*o$
 // See the pipe_steam struct in lsh_ast.h. It contains the command before the pipe and the command after the pipe.
 // run_pipe_stream returns the status code of the last member of the pipe. 0 = success, anything else is failure.
+// Every stage is waited for, so none are left behind as zombies.
 // Hint: see 'man pipe' to create a pipe between processes
 // Hint: see 'man dup2' for making one file descriptor (i.e. stdin or stdout) point to another.
 int run_pipe_stream(struct context *context, const struct pipe_stream *pipe_stream) {
-   int rc = 0;  // Initialize return code
-    int pipe_fds[2];
-    int prev_fd = -1;  // Previous pipe's read end
-    pid_t pid;
-    const struct program *current_program = pipe_stream->first;
-
-    while (current_program != NULL) {
-        // Create a pipe
-        if (pipe(pipe_fds) == -1) {
-            perror("pipe");
-            return -1;
-        }
+    return run_pipe_stream_to(context, pipe_stream, -1, NULL, NULL);
+}
 
-        // Fork a child process
-        pid = fork();
-        if (pid == -1) {
-            perror("fork");
-            return -1;
+// run_pipe_stream() with the last stage's stdout sent to out_fd, or the shell's if that's -1.
+// If capture isn't NULL, it's called with arg once every stage has started, before they are
+// waited for, e.g. to read their output from the other end of a pipe. With an out_fd, every
+// stage must be a program, see pipe_stream_spawnable().
+int run_pipe_stream_to(struct context *context, const struct pipe_stream *pipe_stream, int out_fd, void (*capture)(void *arg), void *arg) {
+    const struct program *current_program = pipe_stream->first;
+    // Stage timings and resource usage are only collected for LSH_TRACE and time.
+    int timed = context->trace != NULL || pipe_stream->timed;
+
+    // A lone program needs no pipe: run_one_program() runs a builtin (even one named by $VAR)
+    // inside the shell, and spawns and waits for anything else. Timing a spawned program wants
+    // its rusage from wait4(), so with timed only builtins take this path.
+    const struct word *argv0 = current_program->words->first;
+    int builtin = !argv0->is_var && !argv0->cmdsub && is_builtin(argv0->text);
+    if (current_program->next == NULL && out_fd == -1 && (builtin || !timed)) {
+        struct stage_usage stage = { .pid = 0 };
+        if (timed)
+            stage.start = trace_now();
+        int rc = run_one_program(context, current_program);
+        rc = context_set_pipestatus(context, &rc, 1);
+        if (timed) {
+            stage.end = trace_now();
+            stage.rc = rc;
+            trace_pipe_stream(context, pipe_stream, &stage, 1, rc);
         }
+        return rc;
+    }
 
-        if (pid == 0) { // Child process
-            if (prev_fd != -1) {
-                // Redirect stdin to the previous pipe's read end
-                if (dup2(prev_fd, STDIN_FILENO) == -1) {
-                    perror("dup2");
-                    exit(EXIT_FAILURE);
-                }
-                close(prev_fd);
-            }
-
-            if (current_program->next != NULL) {
-                // Redirect stdout to the current pipe's write end
-                if (dup2(pipe_fds[1], STDOUT_FILENO) == -1) {
-                    perror("dup2");
-                    exit(EXIT_FAILURE);
-                }
-            }
-
-            // Close unused file descriptors
-            close(pipe_fds[0]); // Close read end
-            close(pipe_fds[1]); // Close write end
-
-            // Execute the current command
-            struct argv_buf *argv = make_argv((const struct context *)context, current_program->words);
-            execvp(argv->argv[0], argv->argv);
-            perror("execvp");
-            exit(EXIT_FAILURE);
-        } else { // Parent process
-            // Close the write end of the current pipe
-            close(pipe_fds[1]);
-
-            if (prev_fd != -1) {
-                // Close the previous pipe's read end
-                close(prev_fd);
+    int n = pipe_stream_length(pipe_stream);
+    pid_t *pids = arena_alloc(&context->scratch, n * sizeof(pid_t));
+    int *rcs = arena_alloc(&context->scratch, n * sizeof(int));
+    struct stage_usage *stages = timed ? arena_alloc(&context->scratch, n * sizeof(struct stage_usage)) : NULL;
+
+    spawn_pipe_stream(context, pipe_stream, pids, out_fd, -1, stages);
+    if (capture != NULL)
+        capture(arg);
+
+    // Wait for every stage. One that could not be started counts as not found, one whose
+    // redirection failed as 1, and an elided `cat FILE` as having succeeded.
+    // wait4() is waitpid() that also returns the child's resource usage.
+    for (int i = 0; i < n; i++) {
+        rcs[i] = pids[i] == 0 ? 0 : pids[i] == -2 ? 1 : 127;
+        if (pids[i] > 0) {
+            int status;
+            pid_t pid;
+            struct rusage ru;
+            while ((pid = wait4(pids[i], &status, 0, &ru)) == -1 && errno == EINTR)
+                ;
+            if (pid == -1) {
+                perror("waitpid");
+                rcs[i] = -1;
+            } else {
+                rcs[i] = wait_status_rc(pids[i], status);
+                if (stages != NULL)
+                    stages[i].ru = ru;
             }
-
-            // Set the current pipe's read end as the previous pipe's read end for the next iteration
-            prev_fd = pipe_fds[0];
-
-            // Move to the next command in the pipe stream
-            current_program = current_program->next;
+        }
+        if (stages != NULL) {
+            stages[i].end = pids[i] > 0 ? trace_now() : stages[i].start;
+            stages[i].rc = rcs[i];
         }
     }
 
-    // After all commands are forked, close the last pipe's read end in the parent
-    if (prev_fd != -1) {
-        close(prev_fd);
-    }
-
-    // Wait for all child processes to complete
-    // This simplistic implementation waits only for the last child
-    // For a more robust solution, you should track all PIDs and wait for each
-    int status;
-    if (waitpid(pid, &status, 0) == -1) {
-        perror("waitpid");
-        return -1;
-    }
-
-    if (WIFEXITED(status)) {
-        rc = WEXITSTATUS(status);
-    } else if (WIFSIGNALED(status)) {
-        printf("Child %d terminated by signal %d\n", pid, WTERMSIG(status));
-        rc = -1;
-    } else {
-        rc = -1;
-    }
-
+    // A command substitution's pipeline leaves the caller's $PIPESTATUS alone: the word
+    // being expanded may be one of several in an argv that already expanded it.
+    int rc = capture != NULL ? pipe_stream_status(context, rcs, n) : context_set_pipestatus(context, rcs, n);
+    if (stages != NULL)
+        trace_pipe_stream(context, pipe_stream, stages, n, rc);
+    arena_release(&context->scratch, pids);
     return rc;
-
-
-
 }
 
 
@@ -697,53 +802,14 @@ int run_pipe_stream(struct context *context, const struct pipe_stream *pipe_stre
  *                                        *
  ******************************************/
 
-void run_statement(struct context *context, const struct statement *statement) {
-	if (statement->background) {
-		run_bg_statement(context, statement);
-	} else {
-		run_fg_statement(context, statement);
-	}
-}
-
-void run_script(struct context *context, const struct script *script) {
-	for (const struct statement *s = script->first; s; s = s->next) {
-		run_statement(context, s);
-	}
-}
-
-static const char *context_get_var_raw(const struct context *context, const char *key) {
-	void *t = tfind(key, &context->env_tree, env_tree_compare);
-	if (t == NULL) {
-		return NULL;
-	}
-	const char *s = *(const char **)t;
-	return s;
-}
-
-const char *context_get_var(const struct context *context, const char *key) {
-	const char *s = context_get_var_raw(context, key);
-	return &s[strlen(key) + 1];
+// Record the return code of the last statement, visible to scripts as $?.
+void context_set_status(struct context *context, int rc) {
+	context->last_status = rc;
+	snprintf(context->last_status_text, sizeof(context->last_status_text), "%d", rc & 0xff);
 }
 
-void context_set_var(struct context *context, const char *key, const char *value) {
-	value = value ? value : "";
-	char *buf = malloc(strlen(key) + strlen(value) + 2);
-	const char *p = key;
-	char *b = buf;
-	while (*p && *p != '=') *b++ = *p++;
-	*b++ = '=';
-	p = value;
-	while (*p) *b++ = *p++;
-	*b++ = 0;
-
-	//fprintf(stderr, "%s: buf: '%s'\n", __FUNCTION__, buf);
-
-	// Delete any existing value.
-	const char *s;
-	while ((s = context_get_var_raw(context, key)) != NULL) {
-		tdelete(buf, &context->env_tree, env_tree_compare);
-		free((void *)s);
-	}
-	tsearch(buf, &context->env_tree, env_tree_compare);
+// Compile the script into the context's plan and run it.
+int run_script(struct context *context, const struct script *script) {
+	compile_plan(context, script);
+	return run_plan(context, 0, context->plan.len);
 }
-
@@ -5,18 +5,25 @@
 #include <stdlib.h>
 #include <string.h>
 #include <search.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/resource.h>
 
 struct argv_buf {
-	char **argv;
 	int argc;
-	size_t used;
-	size_t capacity;
-	char buf[8];	// dynamically grows.
+	int failed;	// An expansion failed, e.g. $((1/0)), so nothing should run.
+	char *argv[];	// argc + 1 entries, followed by the strings they point at.
 };
 
 struct word {
 	const char *text;
 	int is_var;
+	int slot;		// The variable's slot, or 0 to look it up by name, see lsh_var.c
+	int is_glob;		// An unquoted pattern like *.c, see lsh_glob.c
+	struct script *cmdsub;	// $(script), see lsh_subst.c
+	struct arith *arith;	// $((expression)), see lsh_arith.c
+	int cmdsub_start;	// cmdsub compiled into the plan as [cmdsub_start, cmdsub_end).
+	int cmdsub_end;
 	struct word *next;
 };
 
@@ -25,18 +32,49 @@ struct words {
 	struct word *last;
 };
 
+enum redirect_op {
+	REDIR_IN,	// fd<target
+	REDIR_OUT,	// fd>target
+	REDIR_APPEND,	// fd>>target
+	REDIR_DUP,	// fd>&dup_fd
+};
+
+struct redirect {
+	enum redirect_op op;
+	int fd;			// The descriptor being redirected, e.g. 2 in 2>&1.
+	int dup_fd;		// REDIR_DUP: the descriptor it becomes a copy of, e.g. 1 in 2>&1.
+	struct word *target;	// The file, for the others.
+	struct redirect *next;
+};
+
+struct redirects {
+	struct redirect *first;
+	struct redirect *last;
+};
+
+// A descriptor redirect_shell() replaced, and a copy of what it was.
+struct saved_fd {
+	int fd;
+	int copy;
+};
+
 struct program {
 	struct words *words;
+	struct redirects *redirects;	// NULL if there are none.
+	struct argv_buf *argv;	// Prebuilt by compile_plan() if words has no variables.
 	struct program *next;
 };
 
 struct pipe_stream {
 	struct program *first;
 	struct program *last;
+	int timed;		// Prefixed with the time keyword.
+	const char *input;	// Set by compile_plan() if the first stage is just `cat input`.
 };
 
 struct statement {
 	struct for_loop *for_loop;
+	struct while_loop *while_loop;
 	struct conditional *conditional;
 	struct pipe_stream *pipe_stream;
 	struct var_assign *var_assign;
@@ -65,40 +103,222 @@ struct for_loop {
 	int parallel;
 	struct word *var_name;
 	struct words *var_values;
+	struct argv_buf *values;	// Prebuilt by compile_plan() if var_values has no variables.
 	struct script *script;
 };
 
+struct while_loop {
+	int until;		// Loop while predicate fails, rather than while it succeeds.
+	struct pipe_stream *predicate;
+	struct script *script;
+	struct redirects *redirects;	// Applied to the whole loop, e.g. `done < file`.
+};
+
 struct var_assign {
 	const char *var_name;
+	int slot;
 	struct words *var_value;	// Kind of a hack to make code simpler, should just be word, not words.
 };	
 
+struct var {
+	char *entry;		// "NAME=VALUE", usable directly as an envp entry.
+	size_t name_len;
+	size_t capacity;	// Allocated size of entry.
+	int exported;
+	int set;		// Names the parser has seen have a slot before they have a value.
+};
+
+struct var_table {
+	struct var *vars;	// Indexed by slot - 1, see lsh_var.c
+	size_t capacity;
+	size_t count;
+	int *buckets;		// Open addressing hash of name -> slot, nbuckets is a power of two.
+	size_t nbuckets;
+	char **envp;		// Cached exported variables for children.
+	int envp_dirty;
+	char **pending_env;	// The environment, until it has been imported, see lsh_var.c
+
+};
+
+struct job_proc {
+	pid_t pid;
+	int done;
+	int status;		// From waitpid(), once done.
+};
+
+struct job {
+	int id;			// %N
+	pid_t pid;		// The last process, whose status is the job's.
+	struct job_proc *procs;	// Every process in the job, e.g. each stage of a pipeline.
+	int nprocs;
+	int running;
+	int done;
+	int status;		// The job's status in waitpid() form, once done.
+	char *text;		// The command, for jobs.
+};
+
+struct job_table {
+	struct job *jobs;	// In the order they were started.
+	int count;
+	int capacity;
+	int next_id;
+	int watching;		// SIGCHLD is blocked and sigchld_fd is open.
+	int sigchld_fd;
+};
+
+// How one stage of a pipeline went, for LSH_TRACE and time, see lsh_trace.c
+struct stage_usage {
+	pid_t pid;		// 0 if the shell did it (a builtin, an elided cat), -1 if it couldn't be started.
+	int rc;
+	long long start;	// trace_now() times.
+	long long end;
+	struct rusage ru;	// From wait4(), zero for a builtin.
+};
+
+// The paths a pattern matched, each malloc'd.
+struct glob_matches {
+	char **paths;
+	int count;
+	int capacity;
+};
+
+// Directory listings read while expanding patterns, see lsh_glob.c
+struct glob_cache {
+	struct glob_dir *dirs;
+	int count;
+	int capacity;
+};
+
+// stat() results for test, see lsh_test.c
+struct stat_cache {
+	struct stat_entry *entries;
+	int count;
+	int capacity;
+};
+
+// The read builtin's stdin buffer, see lsh_read.c
+struct read_buffer {
+	char *data;
+	size_t pos;		// data[pos, len) has been read from stdin but not by read.
+	size_t len;
+	int buffered;		// Read stdin in blocks, not a byte at a time.
+	char *line;		// The line being read.
+	size_t line_capacity;
+};
+
+struct arena {
+	struct arena_chunk *chunks;
+};
+
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strdup(struct arena *arena, const char *s);
+char *arena_strndup(struct arena *arena, const char *s, size_t n);
+void arena_release(struct arena *arena, void *p);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
+
+enum plan_op {
+	OP_PIPE,	// Run pipe_stream.
+	OP_TEST,	// Run pipe_stream, jump to target if it failed.
+	OP_ASSIGN,	// Run var_assign.
+	OP_STATUS,	// Succeed, e.g. a conditional with no branch taken.
+	OP_JUMP,	// Jump to target.
+	OP_FOR,		// Expand for_loop's values into the OP_NEXT that follows.
+	OP_NEXT,	// Set the loop variable to the next value, or jump to target when done.
+	OP_WHILE,	// Run pipe_stream, continue if it succeeded (failed for until), else jump to target.
+	OP_REDIRECT,	// Apply redirects to the shell, or jump to target if that fails.
+	OP_RESTORE,	// Undo the OP_REDIRECT at target.
+	OP_PDO,		// Run [pc + 1, target) once per value in parallel, then continue at target.
+	OP_BG,		// Run [pc + 1, target) in a background child, continue at target.
+};
+
+// One step of a compiled script, see lsh_plan.c.
+struct instr {
+	enum plan_op op;
+	int target;
+	const struct pipe_stream *pipe_stream;
+	const struct var_assign *var_assign;
+	const struct for_loop *for_loop;
+	const struct while_loop *while_loop;
+	const struct statement *statement;	// OP_BG
+	const struct redirects *redirects;	// OP_REDIRECT
+	struct redirect_frame *frame;	// OP_REDIRECT: what to restore, see lsh_plan.c
+	struct argv_buf *values;	// OP_NEXT: the values being iterated over.
+	int next;			// OP_NEXT: index of the next value. OP_WHILE: whether the body has run.
+	int buffered;			// OP_WHILE: read stdin in blocks in the loop, see lsh_read.c
+};
+
+struct plan {
+	struct instr *code;
+	int len;
+	int capacity;
+};
+
 struct context {
 	struct script *script;
-	void *env_tree;
-	void *pid_wait_tree;
+	struct arena arena;	// Owns the parsed script and its token text.
+	struct arena scratch;	// Short-lived allocations like argvs, released in stack order.
+	struct plan plan;	// script compiled by compile_plan().
+	struct var_table vars;
+	struct job_table jobs;	// Background jobs, see lsh_job.c
+	FILE *trace;		// LSH_TRACE output, see lsh_trace.c
+	int trace_nested;	// trace was created by a parent lsh, which will finish it.
+	pid_t trace_pid;	// The shell that opened trace, rather than a forked copy of it.
+	struct glob_cache globs;	// Cleared for each top-level statement.
+	struct stat_cache stats;	// Cleared whenever a command other than test runs.
+	struct read_buffer input;	// stdin as read by the read builtin.
+	void *path_cache;	// tsearch tree of command name -> executable path, see lsh_path.c
+	int interactive;	// Reading commands from a terminal.
+	int noexec;		// -n: parse only.
+	int lex_word_next;	// Lexer: the next word can't be a keyword, see lsh.lex
+	int pipefail;		// set -o pipefail: a pipeline fails if any stage does.
+	int last_status;
+	char last_status_text[12];	// last_status formatted for $?
 };
 
 void context_set_var(struct context *context, const char *key, const char *value);
 const char *context_get_var(const struct context *context, const char *key);
-int env_tree_compare(const void *_a, const void *_b);
-void tsearch_print_env_tree(const void *nodep, VISIT which, int depth);
+int context_var_slot(struct context *context, const char *key);
+void context_set_slot(struct context *context, int slot, const char *value);
+const char *context_get_slot(const struct context *context, int slot);
+void context_export_var(struct context *context, const char *key);
+void context_import_env(struct context *context, const char *entry);
+void context_set_environ(struct context *context, char **env);
+char **context_envp(struct context *context);
+void context_print_vars(struct context *context, int exported_only);
+void context_each_var(struct context *context, const char *prefix, void (*fn)(const char *name, size_t len, void *arg), void *arg);
+void context_free_vars(struct context *context);
+void context_set_status(struct context *context, int rc);
 
 #define append_ll(a, b)		do { if (a->first == NULL) { a->first = a->last = b; } else { a->last->next = b; a->last = b; b->next = NULL; } } while(0)
 #define prepend_ll(a, b)	do { if (a->first == NULL) { a->first = a->last = b; } else { b->next = a->first; a->first = b; } } while(0)
 
-#define CREATE_NEW_FN(x)	static inline struct x *new_##x() { struct x *p = malloc(sizeof(struct x)); memset(p, 0, sizeof(struct x)); return p; }
+#define CREATE_NEW_FN(x)	static inline struct x *new_##x(struct arena *arena) { return arena_alloc(arena, sizeof(struct x)); }
 CREATE_NEW_FN(word)
 CREATE_NEW_FN(words)
 CREATE_NEW_FN(program)
+CREATE_NEW_FN(redirect)
+CREATE_NEW_FN(redirects)
 CREATE_NEW_FN(pipe_stream)
 CREATE_NEW_FN(statement)
 CREATE_NEW_FN(script)
 CREATE_NEW_FN(conditional_part)
 CREATE_NEW_FN(conditional)
 CREATE_NEW_FN(for_loop)
+CREATE_NEW_FN(while_loop)
 CREATE_NEW_FN(var_assign)
-CREATE_NEW_FN(context)
+
+// Whether a word is used as it's written, rather than being expanded.
+static inline int word_is_literal(const struct word *word) {
+	return !word->is_var && !word->is_glob && !word->cmdsub && !word->arith;
+}
+
+// The value of a variable word, NULL if it's unset.
+static inline const char *word_var_value(const struct context *context, const struct word *word) {
+	return word->slot ? context_get_slot(context, word->slot) : context_get_var(context, word->text);
+}
+
+static inline struct context *new_context() { struct context *p = malloc(sizeof(struct context)); memset(p, 0, sizeof(struct context)); return p; }
 
 // Hacks here because the lexer and parser are co-dependent for type definitions.
 #define YY_TYPEDEF_YY_SCANNER_T
@@ -111,22 +331,85 @@ void print_statement(FILE *f, const struct statement *statement, int depth);
 void print_script(FILE *f, const struct script *script, int depth);
 void print_var_assign(FILE *f, const struct var_assign *var_assign, int depth);
 
-void free_word(struct word *word);
-void free_words(struct words *words);
-void free_program(struct program *program);
-void free_pipe_stream(struct pipe_stream *pipe_stream);
-void free_statement(struct statement *statement);
-void free_script(struct script *script);
-void free_conditional_part(struct conditional_part *conditional_part);
-void free_conditional(struct conditional *conditional);
-void free_var_assign(struct var_assign *var_assign);
+void free_script(struct context *context);
 void free_context(struct context *context);
 
-int run_program(struct context *context, const struct program *program);
+struct argv_buf *make_argv(struct context *context, struct arena *arena, const struct words *words);
+void free_argv(struct context *context, struct argv_buf *buf);
+
 int run_pipe_stream(struct context *context, const struct pipe_stream *pipe_stream);
-void run_statement(struct context *context, const struct statement *statement);
-void run_script(struct context *context, const struct script *script);
-void run_conditional(struct context *context, const struct conditional *conditional);
+int run_pipe_stream_to(struct context *context, const struct pipe_stream *pipe_stream, int out_fd, void (*capture)(void *arg), void *arg);
+int pipe_stream_spawnable(const struct pipe_stream *pipe_stream);
+int run_one_program(struct context *context, const struct program *program);
+char *run_command_subst(struct context *context, const struct word *word, int *rc);
+int run_var_assign(struct context *context, const struct var_assign *var_assign);
+void run_bg_statement(struct context *context, const struct statement *statement, int start, int end);
+int run_statement(struct context *context, const struct statement *statement);
+int run_script(struct context *context, const struct script *script);
+int wait_status_rc(pid_t pid, int status);
+pid_t spawn_program(struct context *context, char **argv, int in_fd, int out_fd, const struct redirects *redirects, pid_t pgid);
+
+struct redirect *parse_redirect(struct arena *arena, const char *op, struct word *target);
+int redirects_count(const struct redirects *redirects);
+int redirects_stdin(const struct redirects *redirects);
+int redirect_file_actions(struct context *context, const struct redirects *redirects, posix_spawn_file_actions_t *actions, int *fds);
+int redirect_shell(struct context *context, const struct redirects *redirects, struct saved_fd *saved, int *nsaved);
+void redirect_restore(struct saved_fd *saved, int nsaved);
+
+void compile_plan(struct context *context, const struct script *script);
+int run_plan(struct context *context, int pc, int end);
+void free_plan(struct plan *plan);
+
+const char *path_cache_lookup(struct context *context, const char *name);
+void path_cache_forget(struct context *context, const char *name);
+void path_cache_clear(struct context *context);
+
+int has_glob_meta(const char *s);
+int glob_expand(struct context *context, const char *pattern, struct glob_matches *m);
+void glob_matches_free(struct glob_matches *m);
+void glob_cache_clear(struct context *context);
+void glob_cache_free(struct context *context);
+int builtin_hash(struct context *context, char **argv, int argc);
+
+int jobs_add(struct context *context, const pid_t *pids, int n, char *text);
+void jobs_poll(struct context *context);
+void jobs_reaped(struct context *context, pid_t pid, int status);
+void jobs_notify(struct context *context);
+void jobs_forget(struct context *context);
+void jobs_free(struct context *context);
+char *statement_text(const struct statement *statement);
+int builtin_wait(struct context *context, char **argv, int argc);
+int builtin_jobs(struct context *context, char **argv, int argc);
+
+void completion_start(struct context *context, void *lib);
+void completion_refresh(struct context *context);
+
+long long trace_now(void);
+int trace_open(struct context *context, const char *path);
+void trace_close(struct context *context);
+void trace_statement(struct context *context, const struct statement *statement, long long start, long long end, int rc);
+void trace_pipe_stream(struct context *context, const struct pipe_stream *pipe_stream, const struct stage_usage *stages, int n, int rc);
+
+struct arith *parse_arith(struct context *context, struct arena *arena, const char *text);
+int eval_arith(struct context *context, const struct arith *a, long long *result);
+int arith_assigns(const struct arith *a);
+int builtin_let(struct context *context, char **argv, int argc);
+
+int builtin_test(struct context *context, char **argv, int argc);
+int is_test_builtin(const char *argv0);
+void stat_cache_clear(struct context *context);
+void stat_cache_free(struct context *context);
+
+int builtin_read(struct context *context, char **argv, int argc);
+void read_buffer_release(struct context *context);
+void read_buffer_push(struct context *context, struct read_buffer *saved);
+void read_buffer_pop(struct context *context, struct read_buffer *saved);
+void read_buffer_free(struct context *context);
+
+int is_builtin(const char *argv0);
+int is_pure_builtin(const char *argv0);
+const char *builtin_name(int i);
+int handle_builtin(struct context *context, char **argv, int argc);
 
 // Turn the actual implementation on.
 #define SOLUTION
@@ -0,0 +1,345 @@
+// Intrinsic commands. These run inside the shell process, so they can change the shell's own state
+// (cd, exit) and so hot commands like echo and true don't pay for a fork and exec.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <limits.h>
+#include <search.h>
+#include <inttypes.h>
+
+#include "lsh_ast.h"
+
+struct builtin {
+	const char *name;
+	int (*fn)(struct context *context, char **argv, int argc);
+	int pure;		// Only writes output, so $(...) can run it in the shell, see lsh_subst.c
+	const char *usage;
+};
+
+// Expand the backslash escape at *pp (just past the backslash) onto f and advance *pp past it.
+// Returns 1 for \c, which means "produce no further output".
+static int put_escape(FILE *f, const char **pp) {
+	const char *p = *pp;
+	int c = *p++;
+	switch (c) {
+	case 'a': c = '\a'; break;
+	case 'b': c = '\b'; break;
+	case 'e': c = 033; break;
+	case 'f': c = '\f'; break;
+	case 'n': c = '\n'; break;
+	case 'r': c = '\r'; break;
+	case 't': c = '\t'; break;
+	case 'v': c = '\v'; break;
+	case '\\': break;
+	case 'c': *pp = p; return 1;
+	case '0':
+		c = 0;
+		for (int i = 0; i < 3 && *p >= '0' && *p <= '7'; i++)
+			c = c * 8 + (*p++ - '0');
+		break;
+	case 'x':
+		c = 0;
+		for (int i = 0; i < 2 && isxdigit((unsigned char)*p); i++, p++)
+			c = c * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10));
+		break;
+	case 0:
+		// Trailing backslash, print it as-is.
+		p--;
+		c = '\\';
+		break;
+	default:
+		putc('\\', f);
+		break;
+	}
+	putc(c, f);
+	*pp = p;
+	return 0;
+}
+
+// Print s, expanding backslash escapes. Returns 1 if output was cut short by \c.
+static int put_escaped(FILE *f, const char *s) {
+	while (*s) {
+		if (*s == '\\') {
+			s++;
+			if (put_escape(f, &s)) return 1;
+		} else {
+			putc(*s++, f);
+		}
+	}
+	return 0;
+}
+
+static int builtin_colon(struct context *context, char **argv, int argc) {
+	(void)context; (void)argv; (void)argc;
+	return 0;
+}
+
+static int builtin_true(struct context *context, char **argv, int argc) {
+	(void)context; (void)argv; (void)argc;
+	return 0;
+}
+
+static int builtin_false(struct context *context, char **argv, int argc) {
+	(void)context; (void)argv; (void)argc;
+	return 1;
+}
+
+static int builtin_exit(struct context *context, char **argv, int argc) {
+	trace_close(context);	// Leave the trace a complete JSON array.
+	read_buffer_release(context);	// Leave stdin where the script stopped reading.
+	exit(argc > 1 ? atoi(argv[1]) : 0);
+}
+
+static int builtin_cd(struct context *context, char **argv, int argc) {
+	const char *dir = argc > 1 ? argv[1] : context_get_var(context, "HOME");
+	if (dir == NULL) {
+		fprintf(stderr, "cd: HOME not set\n");
+		return EINVAL;
+	}
+	if (chdir(dir) != 0) {
+		perror("cd");
+		return errno;
+	}
+	return 0;
+}
+
+static int builtin_pwd(struct context *context, char **argv, int argc) {
+	(void)context; (void)argv; (void)argc;
+	char buf[PATH_MAX];
+	if (getcwd(buf, sizeof(buf)) == NULL) {
+		perror("pwd");
+		return 1;
+	}
+	puts(buf);
+	return 0;
+}
+
+// echo [-neE] [arg ...], option handling as in bash's builtin.
+static int builtin_echo(struct context *context, char **argv, int argc) {
+	(void)context;
+	int newline = 1, escapes = 0, i;
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != 0; i++) {
+		if (strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1))
+			break;
+		for (const char *p = argv[i] + 1; *p; p++) {
+			if (*p == 'n') newline = 0;
+			else if (*p == 'e') escapes = 1;
+			else escapes = 0;
+		}
+	}
+	for (int first = i; i < argc; i++) {
+		if (i > first) putchar(' ');
+		if (!escapes) {
+			fputs(argv[i], stdout);
+		} else if (put_escaped(stdout, argv[i])) {
+			return 0;
+		}
+	}
+	if (newline) putchar('\n');
+	return 0;
+}
+
+// Numeric printf argument: a number, or 'c / "c for the character code of c.
+static int printf_number(const char *arg, intmax_t *out) {
+	if (arg[0] == '\'' || arg[0] == '"') {
+		*out = (unsigned char)arg[1];
+		return 0;
+	}
+	char *end;
+	errno = 0;
+	*out = strtoimax(arg, &end, 0);
+	if (*arg == 0 || *end != 0 || errno != 0) {
+		fprintf(stderr, "printf: %s: invalid number\n", arg);
+		return 1;
+	}
+	return 0;
+}
+
+// Expand format once, consuming arguments from argv[*arg]. Returns nonzero if output stopped at \c.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+static int printf_once(const char *fmt, char **argv, int argc, int *arg, int *rc) {
+	char spec[32];
+	while (*fmt) {
+		if (*fmt == '\\') {
+			fmt++;
+			if (put_escape(stdout, &fmt)) return 1;
+			continue;
+		}
+		if (*fmt != '%') {
+			putchar(*fmt++);
+			continue;
+		}
+		if (fmt[1] == '%') {
+			putchar('%');
+			fmt += 2;
+			continue;
+		}
+
+		// Copy "%[flags][width][.precision]" into spec, leaving room for a length modifier.
+		size_t n = strspn(fmt + 1, "-+ #0");
+		n += strspn(fmt + 1 + n, "0123456789");
+		if (fmt[1 + n] == '.')
+			n += 1 + strspn(fmt + 2 + n, "0123456789");
+		if (n + 4 >= sizeof(spec)) {
+			fprintf(stderr, "printf: format too long\n");
+			*rc = 1;
+			return 1;
+		}
+		memcpy(spec, fmt, n + 1);
+		char conv = fmt[1 + n];
+		fmt += 2 + n;
+		const char *a = *arg < argc ? argv[(*arg)++] : NULL;
+		intmax_t num = 0;
+
+		switch (conv) {
+		case 'd': case 'i':
+			if (a) *rc |= printf_number(a, &num);
+			strcpy(spec + n + 1, "jd");
+			printf(spec, num);
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			if (a) *rc |= printf_number(a, &num);
+			spec[n + 1] = 'j';
+			spec[n + 2] = conv;
+			spec[n + 3] = 0;
+			printf(spec, (uintmax_t)num);
+			break;
+		case 'c':
+			if (a && *a) putchar(*a);
+			break;
+		case 's':
+			strcpy(spec + n + 1, "s");
+			printf(spec, a ? a : "");
+			break;
+		case 'b':
+			if (a && put_escaped(stdout, a)) return 1;
+			break;
+		default:
+			fprintf(stderr, "printf: %%%c: invalid directive\n", conv);
+			*rc = 1;
+			return 1;
+		}
+	}
+	return 0;
+}
+#pragma GCC diagnostic pop
+
+// printf format [arguments], reusing the format until all arguments are consumed.
+static int builtin_printf(struct context *context, char **argv, int argc) {
+	(void)context;
+	if (argc < 2) {
+		fprintf(stderr, "printf: usage: printf format [arguments]\n");
+		return 2;
+	}
+	int arg = 2, rc = 0;
+	while (1) {
+		int before = arg;
+		if (printf_once(argv[1], argv, argc, &arg, &rc)) break;
+		if (arg >= argc || arg == before) break;
+	}
+	return rc;
+}
+
+// export [name ...]: pass variables to child processes, or list the exported ones.
+static int builtin_export(struct context *context, char **argv, int argc) {
+	if (argc == 1) {
+		context_print_vars(context, 1);
+		return 0;
+	}
+	for (int i = 1; i < argc; i++)
+		context_export_var(context, argv[i]);
+	return 0;
+}
+
+// set [-o|+o option]: list variables, or turn a shell option on (-o) or off (+o).
+// The only option is pipefail.
+static int builtin_set(struct context *context, char **argv, int argc) {
+	if (argc == 1) {
+		context_print_vars(context, 0);
+		return 0;
+	}
+	for (int i = 1; i < argc; i++) {
+		int on = strcmp(argv[i], "-o") == 0;
+		if (!on && strcmp(argv[i], "+o") != 0) {
+			fprintf(stderr, "set: %s: invalid option\n", argv[i]);
+			return 2;
+		}
+		if (i + 1 == argc) {
+			printf("pipefail\t%s\n", context->pipefail ? "on" : "off");
+			return 0;
+		}
+		if (strcmp(argv[++i], "pipefail") != 0) {
+			fprintf(stderr, "set: %s: invalid option name\n", argv[i]);
+			return 1;
+		}
+		context->pipefail = on;
+	}
+	return 0;
+}
+
+static int builtin_help(struct context *context, char **argv, int argc);
+
+// Keep sorted by name: find_builtin() uses bsearch().
+static const struct builtin builtins[] = {
+	{ ":",		builtin_colon,	1,	": Do nothing, successfully" },
+	{ "[",		builtin_test,	1,	"[ expression ]: Evaluate a file, string or integer predicate" },
+	{ "cd",		builtin_cd,	0,	"cd [dir]: Change the current directory to [dir]" },
+	{ "echo",	builtin_echo,	1,	"echo [-neE] [arg ...]: Write arguments to standard output" },
+	{ "exit",	builtin_exit,	0,	"exit [n]: Exit the shell" },
+	{ "export",	builtin_export,	0,	"export [name ...]: Pass variables to child processes, or list them" },
+	{ "false",	builtin_false,	1,	"false: Return an unsuccessful result" },
+	{ "hash",	builtin_hash,	0,	"hash [-r] [name ...]: List, clear or add to the command path cache" },
+	{ "help",	builtin_help,	1,	"help: Display this help message" },
+	{ "jobs",	builtin_jobs,	0,	"jobs: List background jobs and their status" },
+	{ "let",	builtin_let,	0,	"let expression ...: Evaluate arithmetic expressions, failing if the last is 0" },
+	{ "printf",	builtin_printf,	1,	"printf format [arguments]: Write formatted output" },
+	{ "pwd",	builtin_pwd,	1,	"pwd: Print the current directory" },
+	{ "read",	builtin_read,	0,	"read [-r] [name ...]: Read a line from standard input into variables" },
+	{ "set",	builtin_set,	0,	"set [-o|+o pipefail]: List variables, or set or unset a shell option" },
+	{ "test",	builtin_test,	1,	"test expression: Evaluate a file, string or integer predicate" },
+	{ "true",	builtin_true,	1,	"true: Return a successful result" },
+	{ "wait",	builtin_wait,	0,	"wait [-n] [pid|%job ...]: Wait for background jobs to finish" },
+};
+
+static int builtin_help(struct context *context, char **argv, int argc) {
+	(void)context; (void)argv; (void)argc;
+	printf("Built-in commands:\n");
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+		printf("  %s\n", builtins[i].usage);
+	return 0;
+}
+
+static int builtin_compare(const void *key, const void *b) {
+	return strcmp(key, ((const struct builtin *)b)->name);
+}
+
+static const struct builtin *find_builtin(const char *name) {
+	return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]), sizeof(builtins[0]), builtin_compare);
+}
+
+// Determines if the given command (string) is an intrinsic command.
+int is_builtin(const char *argv0) {
+	return find_builtin(argv0) != NULL;
+}
+
+// The name of the i'th builtin, or NULL past the last one.
+const char *builtin_name(int i) {
+	return (size_t)i < sizeof(builtins) / sizeof(builtins[0]) ? builtins[i].name : NULL;
+}
+
+int is_pure_builtin(const char *argv0) {
+	const struct builtin *b = find_builtin(argv0);
+	return b != NULL && b->pure;
+}
+
+// Run an intrinsic command in the shell process and return its status.
+int handle_builtin(struct context *context, char **argv, int argc) {
+	const struct builtin *b = find_builtin(argv[0]);
+	if (b == NULL)
+		return EINVAL;
+	return b->fn(context, argv, argc);
+}
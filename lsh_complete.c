@@ -0,0 +1,346 @@
+// Tab completion at the interactive prompt. A command name completes from the builtins and
+// an index of the executables in $PATH, and a word after a $ completes from the variables.
+// Other words are left to readline's filename completion.
+//
+// The index is built by a background thread, so the prompt never waits for a directory scan,
+// which on a network filesystem can take seconds. Until the first scan finishes, commands
+// complete from the builtins only. Each prompt wakes the thread, which stats the $PATH
+// directories and rereads the ones whose mtime or inode has changed, then swaps in the new
+// index. Polling mtimes works on NFS, where inotify never sees changes made by other hosts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "lsh_ast.h"
+
+#define DEFAULT_PATH	"/usr/local/bin:/usr/bin:/bin"
+
+// readline's variables, found with dlsym() since readline itself is loaded that way.
+typedef char **rl_completion_fn(const char *text, int start, int end);
+static rl_completion_fn **rl_attempted_completion_function;
+static int *rl_attempted_completion_over;
+static char **rl_line_buffer;
+
+struct path_dir {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	char **names;		// Executables, sorted.
+	int count;
+};
+
+// Shared between the prompt and the indexing thread: lock protects everything but dirs,
+// which only the thread touches.
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int kicked;
+	char *path;		// $PATH as of the last prompt.
+	char **names;		// Every directory's executables, sorted and without duplicates.
+	int count;
+	struct path_dir *dirs;
+	int ndirs;
+} path_index = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, NULL, NULL, 0, NULL, 0 };
+
+static struct context *completion_context;
+
+static int compare_strings(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void add_name(char ***names, int *count, int *capacity, char *name) {
+	if (*count == *capacity) {
+		*capacity = *capacity ? *capacity * 2 : 64;
+		*names = realloc(*names, *capacity * sizeof(char *));
+		if (*names == NULL) {
+			fprintf(stderr, "realloc() failed for completions!\n");
+			exit(1);
+		}
+	}
+	(*names)[(*count)++] = name;
+}
+
+static void free_names(char **names, int count) {
+	for (int i = 0; i < count; i++)
+		free(names[i]);
+	free(names);
+}
+
+// Reread dir's executables if it has changed since they were last read. Returns whether it had.
+static int path_dir_update(struct path_dir *dir) {
+	struct stat st;
+	if (stat(dir->path, &st) == -1 || !S_ISDIR(st.st_mode)) {
+		int changed = dir->count > 0;
+		free_names(dir->names, dir->count);
+		dir->names = NULL;
+		dir->count = 0;
+		dir->ino = 0;
+		return changed;
+	}
+	if (dir->dev == st.st_dev && dir->ino == st.st_ino &&
+	    dir->mtime.tv_sec == st.st_mtim.tv_sec && dir->mtime.tv_nsec == st.st_mtim.tv_nsec)
+		return 0;
+
+	free_names(dir->names, dir->count);
+	dir->names = NULL;
+	dir->count = 0;
+	dir->dev = st.st_dev;
+	dir->ino = st.st_ino;
+	dir->mtime = st.st_mtim;
+
+	DIR *d = opendir(dir->path);
+	if (d == NULL)
+		return 1;
+	int capacity = 0;
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] == '.' || e->d_type == DT_DIR)
+			continue;
+		struct stat entry;
+		if (fstatat(dirfd(d), e->d_name, &entry, 0) == 0 && S_ISREG(entry.st_mode) && (entry.st_mode & 0111))
+			add_name(&dir->names, &dir->count, &capacity, strdup(e->d_name));
+	}
+	closedir(d);
+	if (dir->count > 1)
+		qsort(dir->names, dir->count, sizeof(char *), compare_strings);
+	return 1;
+}
+
+// Make the thread's directories those of path, keeping the ones it already has.
+static int path_dirs_set(const char *path) {
+	struct path_dir *dirs = NULL;
+	int ndirs = 0, changed = 0;
+	for (const char *p = path; ; ) {
+		size_t len = strcspn(p, ":");
+		char *dir_path = len ? strndup(p, len) : strdup(".");
+		dirs = realloc(dirs, (ndirs + 1) * sizeof(struct path_dir));
+		struct path_dir *dir = &dirs[ndirs++];
+		memset(dir, 0, sizeof(*dir));
+		dir->path = dir_path;
+		for (int i = 0; i < path_index.ndirs; i++) {
+			if (path_index.dirs[i].path != NULL && strcmp(path_index.dirs[i].path, dir_path) == 0) {
+				free(dir_path);
+				*dir = path_index.dirs[i];
+				path_index.dirs[i].path = NULL;
+				break;
+			}
+		}
+		if (p[len] == 0)
+			break;
+		p += len + 1;
+	}
+	for (int i = 0; i < path_index.ndirs; i++) {
+		if (path_index.dirs[i].path != NULL) {
+			changed = 1;
+			free(path_index.dirs[i].path);
+			free_names(path_index.dirs[i].names, path_index.dirs[i].count);
+		}
+	}
+	free(path_index.dirs);
+	changed |= ndirs != path_index.ndirs;
+	path_index.dirs = dirs;
+	path_index.ndirs = ndirs;
+	return changed;
+}
+
+// The indexing thread: whenever the prompt wakes it, bring the directories up to date and
+// if any changed, publish a merged list of their names.
+static void *index_thread(void *arg) {
+	(void)arg;
+	char *path = NULL;
+	pthread_mutex_lock(&path_index.lock);
+	for (;;) {
+		while (!path_index.kicked)
+			pthread_cond_wait(&path_index.wake, &path_index.lock);
+		path_index.kicked = 0;
+		int changed = path == NULL || strcmp(path, path_index.path) != 0;
+		if (changed) {
+			free(path);
+			path = strdup(path_index.path);
+		}
+		pthread_mutex_unlock(&path_index.lock);
+
+		if (changed)
+			changed = path_dirs_set(path);
+		for (int i = 0; i < path_index.ndirs; i++)
+			changed |= path_dir_update(&path_index.dirs[i]);
+
+		char **names = NULL;
+		int count = 0, capacity = 0;
+		if (changed) {
+			for (int i = 0; i < path_index.ndirs; i++) {
+				for (int j = 0; j < path_index.dirs[i].count; j++)
+					add_name(&names, &count, &capacity, path_index.dirs[i].names[j]);
+			}
+			if (count > 1)
+				qsort(names, count, sizeof(char *), compare_strings);
+			int n = 0;
+			for (int i = 0; i < count; i++) {
+				if (n == 0 || strcmp(names[n - 1], names[i]) != 0)
+					names[n++] = strdup(names[i]);
+			}
+			count = n;
+		}
+
+		pthread_mutex_lock(&path_index.lock);
+		if (changed) {
+			char **old = path_index.names;
+			int old_count = path_index.count;
+			path_index.names = names;
+			path_index.count = count;
+			pthread_mutex_unlock(&path_index.lock);
+			free_names(old, old_count);
+			pthread_mutex_lock(&path_index.lock);
+		}
+	}
+	return NULL;
+}
+
+// Called before each prompt: tell the thread about $PATH and have it check for changes.
+void completion_refresh(struct context *context) {
+	if (completion_context == NULL)
+		return;
+	const char *path = context_get_var(context, "PATH");
+	if (path == NULL)
+		path = DEFAULT_PATH;
+	pthread_mutex_lock(&path_index.lock);
+	if (path_index.path == NULL || strcmp(path_index.path, path) != 0) {
+		free(path_index.path);
+		path_index.path = strdup(path);
+	}
+	path_index.kicked = 1;
+	pthread_cond_signal(&path_index.wake);
+	pthread_mutex_unlock(&path_index.lock);
+}
+
+struct matches {
+	char **names;
+	int count;
+	int capacity;
+};
+
+static void match_var(const char *name, size_t len, void *arg) {
+	struct matches *m = arg;
+	add_name(&m->names, &m->count, &m->capacity, strndup(name, len));
+}
+
+// Whether the word starting at start is where a command name goes.
+static int command_position(const char *line, int start) {
+	static const char *const keywords[] = { "do", "pdo", "then", "else", "if", "elif", "while", "until", "time" };
+	int i = start;
+	while (i > 0 && (line[i - 1] == ' ' || line[i - 1] == '\t'))
+		i--;
+	if (i == 0 || strchr("|;&(", line[i - 1]) != NULL)
+		return 1;
+	int end = i;
+	while (i > 0 && line[i - 1] != ' ' && line[i - 1] != '\t' && strchr("|;&(", line[i - 1]) == NULL)
+		i--;
+	for (size_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++) {
+		if (strlen(keywords[k]) == (size_t)(end - i) && strncmp(line + i, keywords[k], end - i) == 0)
+			return command_position(line, i);
+	}
+	return 0;
+}
+
+// readline's attempted completion hook. Returns matches in readline's form: the text to
+// replace the word with, then each match, then NULL; or NULL to fall back to filenames.
+static char **complete(const char *text, int start, int end) {
+	(void)end;
+	struct matches m = { 0 };
+	const char *line = *rl_line_buffer;
+	size_t len = strlen(text);
+
+	if (start > 0 && line[start - 1] == '$') {
+		// $ is a word break character, so text is the name without it.
+		context_each_var(completion_context, text, match_var, &m);
+	} else if (command_position(line, start) && strchr(text, '/') == NULL) {
+		for (int i = 0; builtin_name(i) != NULL; i++) {
+			if (strncmp(builtin_name(i), text, len) == 0)
+				add_name(&m.names, &m.count, &m.capacity, strdup(builtin_name(i)));
+		}
+		pthread_mutex_lock(&path_index.lock);
+		int lo = 0, hi = path_index.count;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (strcmp(path_index.names[mid], text) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (int i = lo; i < path_index.count && strncmp(path_index.names[i], text, len) == 0; i++)
+			add_name(&m.names, &m.count, &m.capacity, strdup(path_index.names[i]));
+		pthread_mutex_unlock(&path_index.lock);
+	} else {
+		return NULL;
+	}
+
+	*rl_attempted_completion_over = 1;	// Don't list files instead of nothing.
+	if (m.count == 0) {
+		free(m.names);
+		return NULL;
+	}
+	qsort(m.names, m.count, sizeof(char *), compare_strings);
+	int n = 0;
+	for (int i = 0; i < m.count; i++) {
+		if (n == 0 || strcmp(m.names[n - 1], m.names[i]) != 0)
+			m.names[n++] = m.names[i];
+		else
+			free(m.names[i]);
+	}
+
+	// readline frees the array and its strings.
+	char **result = malloc((n + 2) * sizeof(char *));
+	size_t common = strlen(m.names[0]);
+	for (int i = 1; i < n; i++) {
+		size_t j = 0;
+		while (j < common && m.names[i][j] == m.names[0][j])
+			j++;
+		common = j;
+	}
+	result[0] = strndup(m.names[0], common);
+	if (n == 1) {
+		free(m.names[0]);
+		result[1] = NULL;
+	} else {
+		memcpy(result + 1, m.names, n * sizeof(char *));
+		result[n + 1] = NULL;
+	}
+	free(m.names);
+	return result;
+}
+
+// Hook completion into readline, loaded as lib, and start indexing $PATH.
+void completion_start(struct context *context, void *lib) {
+	void *fn = dlsym(lib, "rl_attempted_completion_function");
+	rl_attempted_completion_over = dlsym(lib, "rl_attempted_completion_over");
+	rl_line_buffer = dlsym(lib, "rl_line_buffer");
+	if (fn == NULL || rl_attempted_completion_over == NULL || rl_line_buffer == NULL)
+		return;
+	rl_attempted_completion_function = fn;
+	completion_context = context;
+	*rl_attempted_completion_function = complete;
+
+	// The thread starts with every signal blocked, so they all go to the main thread. In
+	// particular SIGCHLD, which the shell reads from a signalfd once it blocks it there, see
+	// lsh_job.c: a thread with it unblocked would discard it.
+	pthread_t thread;
+	pthread_attr_t attr;
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int rc = pthread_create(&thread, &attr, index_thread, NULL);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rc != 0)
+		perror("pthread_create");	// Commands complete from the builtins alone.
+}
@@ -0,0 +1,255 @@
+// Pathname expansion: a word with *, ? or [...] in it becomes the sorted list of paths it
+// matches, or stays as it is if it matches nothing, as in sh. Names starting with a dot only
+// match a pattern that starts with one, and . and .. never do.
+//
+// Directory listings are cached for the length of a top-level statement, so a loop matching
+// patterns against the same directory reads it once. A listing is reused only while the
+// directory's inode and mtime are unchanged, and not at all if the directory was modified
+// within a second of being read, when a further change could leave its mtime the same.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include "lsh_ast.h"
+
+struct glob_name {
+	char *name;
+	unsigned char type;	// d_type, DT_UNKNOWN if the filesystem doesn't say.
+};
+
+struct glob_dir {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	int racy;		// Modified too recently to trust mtime, see above.
+	struct glob_name *names;	// Sorted.
+	int count;
+};
+
+// Whether s has a pattern in it. A [ without a closing ] doesn't count, so `[ -f x ]` doesn't
+// read the directory.
+int has_glob_meta(const char *s) {
+	for (; *s; s++) {
+		if (*s == '*' || *s == '?')
+			return 1;
+		if (*s == '[' && strchr(s + 1, ']') != NULL)
+			return 1;
+	}
+	return 0;
+}
+
+static int compare_paths(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(((const struct glob_name *)a)->name, ((const struct glob_name *)b)->name);
+}
+
+static void glob_dir_clear(struct glob_dir *dir) {
+	for (int i = 0; i < dir->count; i++)
+		free(dir->names[i].name);
+	free(dir->names);
+	dir->names = NULL;
+	dir->count = 0;
+}
+
+// Read dir->path into dir, sorted. st is its stat().
+static void glob_dir_read(struct glob_dir *dir, const struct stat *st) {
+	glob_dir_clear(dir);
+	dir->dev = st->st_dev;
+	dir->ino = st->st_ino;
+	dir->mtime = st->st_mtim;
+	dir->racy = st->st_mtim.tv_sec >= time(NULL) - 1;
+
+	DIR *d = opendir(dir->path);
+	if (d == NULL)
+		return;
+	int capacity = 0;
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL) {
+		if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+			continue;
+		if (dir->count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			dir->names = realloc(dir->names, capacity * sizeof(struct glob_name));
+			if (dir->names == NULL) {
+				fprintf(stderr, "realloc() failed for directory listing!\n");
+				exit(1);
+			}
+		}
+		dir->names[dir->count].name = strdup(e->d_name);
+		dir->names[dir->count++].type = e->d_type;
+	}
+	closedir(d);
+	if (dir->count > 1)
+		qsort(dir->names, dir->count, sizeof(struct glob_name), compare_names);
+}
+
+// The listing of the directory path ("" for the current one), from the cache if it's current.
+static struct glob_dir *glob_dir_list(struct context *context, const char *path) {
+	struct glob_cache *cache = &context->globs;
+	struct stat st;
+	if (stat(*path ? path : ".", &st) == -1 || !S_ISDIR(st.st_mode))
+		return NULL;
+
+	struct glob_dir *dir = NULL;
+	for (int i = 0; i < cache->count; i++) {
+		if (strcmp(cache->dirs[i].path, *path ? path : ".") == 0) {
+			dir = &cache->dirs[i];
+			break;
+		}
+	}
+	if (dir != NULL && !dir->racy && dir->dev == st.st_dev && dir->ino == st.st_ino &&
+	    dir->mtime.tv_sec == st.st_mtim.tv_sec && dir->mtime.tv_nsec == st.st_mtim.tv_nsec)
+		return dir;
+
+	if (dir == NULL) {
+		if (cache->count == cache->capacity) {
+			cache->capacity = cache->capacity ? cache->capacity * 2 : 8;
+			cache->dirs = realloc(cache->dirs, cache->capacity * sizeof(struct glob_dir));
+			if (cache->dirs == NULL) {
+				fprintf(stderr, "realloc() failed for glob cache!\n");
+				exit(1);
+			}
+		}
+		dir = &cache->dirs[cache->count++];
+		memset(dir, 0, sizeof(*dir));
+		dir->path = strdup(*path ? path : ".");
+	}
+	glob_dir_read(dir, &st);
+	return dir;
+}
+
+static void add_match(struct glob_matches *m, char *path) {
+	if (m->count == m->capacity) {
+		m->capacity = m->capacity ? m->capacity * 2 : 16;
+		m->paths = realloc(m->paths, m->capacity * sizeof(char *));
+		if (m->paths == NULL) {
+			fprintf(stderr, "realloc() failed for glob matches!\n");
+			exit(1);
+		}
+	}
+	m->paths[m->count++] = path;
+}
+
+static int is_dir(const char *path, unsigned char type) {
+	struct stat st;
+	if (type == DT_DIR)
+		return 1;
+	if (type != DT_UNKNOWN && type != DT_LNK)
+		return 0;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Match pattern, a path relative to prefix (which is "" or ends in a slash), adding matches.
+static void glob_path(struct context *context, const char *prefix, const char *pattern, struct glob_matches *m) {
+	const char *slash = strchr(pattern, '/');
+	size_t len = slash ? (size_t)(slash - pattern) : strlen(pattern);
+	const char *rest = slash;
+	if (rest != NULL) {
+		while (*rest == '/')
+			rest++;
+	}
+
+	char *component = strndup(pattern, len);
+	size_t prefix_len = strlen(prefix);
+	if (!has_glob_meta(component)) {
+		// A literal component, e.g. log in log/*.txt, is looked up rather than listed.
+		char *path = malloc(prefix_len + len + 2);
+		sprintf(path, "%s%s", prefix, component);
+		struct stat st;
+		free(component);
+		if (rest == NULL) {
+			if (lstat(path, &st) == 0) {
+				add_match(m, path);
+				return;
+			}
+		} else if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+			strcat(path, "/");
+			if (*rest) {
+				glob_path(context, path, rest, m);
+			} else {
+				add_match(m, path);
+				return;
+			}
+		}
+		free(path);
+		return;
+	}
+
+	// The prefix without its slash names the directory to list, except for the root.
+	char *dir_path = strdup(prefix);
+	if (prefix_len > 1)
+		dir_path[prefix_len - 1] = 0;
+	struct glob_dir *dir = glob_dir_list(context, dir_path);
+	free(dir_path);
+	struct glob_matches dirs = { 0 };
+	for (int i = 0; dir != NULL && i < dir->count; i++) {
+		const struct glob_name *name = &dir->names[i];
+		if (fnmatch(component, name->name, FNM_PERIOD) != 0)
+			continue;
+		char *path = malloc(prefix_len + strlen(name->name) + 2);
+		sprintf(path, "%s%s", prefix, name->name);
+		if (rest == NULL)
+			add_match(m, path);
+		else if (is_dir(path, name->type))
+			add_match(&dirs, strcat(path, "/"));
+		else
+			free(path);
+	}
+	free(component);
+
+	// Matching inside the directories found lists them, which can move the cache's entries,
+	// so it's done once this directory's listing is no longer needed.
+	for (int i = 0; i < dirs.count; i++) {
+		if (*rest) {
+			glob_path(context, dirs.paths[i], rest, m);
+		} else {
+			add_match(m, dirs.paths[i]);
+			dirs.paths[i] = NULL;
+		}
+	}
+	glob_matches_free(&dirs);
+}
+
+// Expand pattern into m, sorted. Returns the number of matches, 0 if it should stay literal.
+int glob_expand(struct context *context, const char *pattern, struct glob_matches *m) {
+	memset(m, 0, sizeof(*m));
+	if (pattern[0] == '/')
+		glob_path(context, "/", pattern + strspn(pattern, "/"), m);
+	else
+		glob_path(context, "", pattern, m);
+	if (m->count > 1)
+		qsort(m->paths, m->count, sizeof(char *), compare_paths);
+	return m->count;
+}
+
+void glob_matches_free(struct glob_matches *m) {
+	for (int i = 0; i < m->count; i++)
+		free(m->paths[i]);
+	free(m->paths);
+	memset(m, 0, sizeof(*m));
+}
+
+// Forget every cached listing, at the start of each top-level statement.
+void glob_cache_clear(struct context *context) {
+	struct glob_cache *cache = &context->globs;
+	for (int i = 0; i < cache->count; i++) {
+		glob_dir_clear(&cache->dirs[i]);
+		free(cache->dirs[i].path);
+	}
+	cache->count = 0;
+}
+
+void glob_cache_free(struct context *context) {
+	glob_cache_clear(context);
+	free(context->globs.dirs);
+	memset(&context->globs, 0, sizeof(context->globs));
+}
@@ -0,0 +1,315 @@
+// Background jobs. Once the first job starts, SIGCHLD is blocked in the shell and read from a
+// signalfd instead, so finished jobs are collected synchronously whenever the shell looks
+// (before starting another job, at the interactive prompt, in wait and jobs), and wait -n can
+// sleep until the next job exits, checking the jobs every JOBS_SLEEP_MS in case a signal was
+// lost. Only job pids are ever waited for here,
+// so this never steals the status of a foreground pipeline stage.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+#include "lsh_ast.h"
+
+#define JOBS_SLEEP_MS	100
+
+// Block SIGCHLD and open the signalfd. Children get an empty signal mask back, see spawn_program().
+static void jobs_watch(struct job_table *table) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+		perror("sigprocmask");
+		return;
+	}
+	if (table->watching)
+		close(table->sigchld_fd);
+	table->sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (table->sigchld_fd == -1) {
+		perror("signalfd");
+		return;
+	}
+	table->watching = 1;
+}
+
+// The job with a process pid, and that process.
+static struct job *job_find(struct job_table *table, pid_t pid, struct job_proc **proc) {
+	for (int i = 0; i < table->count; i++) {
+		struct job *job = &table->jobs[i];
+		for (int j = 0; j < job->nprocs; j++) {
+			if (job->procs[j].pid == pid) {
+				if (proc != NULL)
+					*proc = &job->procs[j];
+				return job;
+			}
+		}
+	}
+	return NULL;
+}
+
+// Parse a wait/jobs argument: a pid, or %N for job N.
+static struct job *job_find_arg(struct job_table *table, const char *arg) {
+	char *end;
+	long n = strtol(arg + (arg[0] == '%'), &end, 10);
+	if (*end != 0 || end == arg + (arg[0] == '%'))
+		return NULL;
+	if (arg[0] != '%')
+		return job_find(table, n, NULL);
+	for (int i = 0; i < table->count; i++) {
+		if (table->jobs[i].id == n)
+			return &table->jobs[i];
+	}
+	return NULL;
+}
+
+static void job_remove(struct job_table *table, struct job *job) {
+	free(job->procs);
+	free(job->text);
+	int i = job - table->jobs;
+	memmove(job, job + 1, (table->count - i - 1) * sizeof(*job));
+	if (--table->count == 0)
+		table->next_id = 0;	// Like sh, start numbering again once there are no jobs.
+}
+
+// Record that one of job's processes exited. Once they all have, the job's status is the
+// last process's, or with pipefail the last failing one's, as for a foreground pipeline.
+static void job_proc_done(const struct context *context, struct job *job, struct job_proc *proc, int status) {
+	proc->status = status;
+	proc->done = 1;
+	if (--job->running > 0)
+		return;
+	job->done = 1;
+	job->status = job->procs[job->nprocs - 1].status;
+	for (int i = 0; context->pipefail && i < job->nprocs; i++) {
+		if (job->procs[i].status != 0)
+			job->status = job->procs[i].status;
+	}
+}
+
+// Forget the signals that have arrived and collect every job that has finished.
+void jobs_poll(struct context *context) {
+	struct job_table *table = &context->jobs;
+	if (!table->watching)
+		return;
+
+	struct signalfd_siginfo info[16];
+	while (read(table->sigchld_fd, info, sizeof(info)) > 0)
+		;
+
+	for (int i = 0; i < table->count; i++) {
+		struct job *job = &table->jobs[i];
+		for (int j = 0; j < job->nprocs && !job->done; j++) {
+			struct job_proc *proc = &job->procs[j];
+			int status;
+			if (!proc->done && waitpid(proc->pid, &status, WNOHANG) == proc->pid)
+				job_proc_done(context, job, proc, status);
+		}
+	}
+}
+
+// Sleep until a SIGCHLD arrives, then collect finished jobs. Signals of the same kind can
+// coalesce or, if something unblocked SIGCHLD, go astray, so the sleep is bounded and
+// jobs_poll()'s waitpid() sweep finds what finished even without one.
+static void jobs_sleep(struct context *context) {
+	struct pollfd pfd = { .fd = context->jobs.sigchld_fd, .events = POLLIN };
+	if (poll(&pfd, 1, JOBS_SLEEP_MS) == -1 && errno != EINTR)
+		perror("poll");
+	jobs_poll(context);
+}
+
+// A job was reaped by someone else's waitpid(-1), e.g. while waiting for pdo iterations.
+void jobs_reaped(struct context *context, pid_t pid, int status) {
+	struct job_proc *proc;
+	struct job *job = job_find(&context->jobs, pid, &proc);
+	if (job != NULL && !proc->done)
+		job_proc_done(context, job, proc, status);
+}
+
+// Track the n processes in pids as a background job running the given command text (which
+// the table takes).
+int jobs_add(struct context *context, const pid_t *pids, int n, char *text) {
+	struct job_table *table = &context->jobs;
+	if (!table->watching)
+		jobs_watch(table);
+	jobs_poll(context);	// Don't let finished jobs pile up as zombies while launching more.
+
+	if (table->count == table->capacity) {
+		table->capacity = table->capacity ? table->capacity * 2 : 16;
+		table->jobs = realloc(table->jobs, table->capacity * sizeof(struct job));
+		if (table->jobs == NULL) {
+			fprintf(stderr, "realloc() failed for jobs!\n");
+			exit(1);
+		}
+	}
+	struct job *job = &table->jobs[table->count++];
+	memset(job, 0, sizeof(*job));
+	job->id = ++table->next_id;
+	job->pid = pids[n - 1];
+	job->procs = calloc(n, sizeof(struct job_proc));
+	for (int i = 0; i < n; i++)
+		job->procs[i].pid = pids[i];
+	job->nprocs = job->running = n;
+	job->text = text;
+	if (context->interactive)
+		fprintf(stderr, "[%d] %d\n", job->id, job->pid);
+	return job->id;
+}
+
+static void print_job(FILE *f, const struct job *job) {
+	char state[16];
+	if (!job->done)
+		snprintf(state, sizeof(state), "Running");
+	else if (WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0)
+		snprintf(state, sizeof(state), "Done");
+	else if (WIFEXITED(job->status))
+		snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(job->status));
+	else
+		snprintf(state, sizeof(state), "Signal %d", WTERMSIG(job->status));
+	fprintf(f, "[%d]  %-22s  %s &\n", job->id, state, job->text ? job->text : "");
+}
+
+// At the interactive prompt, report jobs that finished since the last one and drop them.
+void jobs_notify(struct context *context) {
+	struct job_table *table = &context->jobs;
+	jobs_poll(context);
+	for (int i = 0; i < table->count; ) {
+		if (table->jobs[i].done) {
+			print_job(stderr, &table->jobs[i]);
+			job_remove(table, &table->jobs[i]);
+		} else {
+			i++;
+		}
+	}
+}
+
+// A forked copy of the shell doesn't own its parent's jobs.
+void jobs_forget(struct context *context) {
+	struct job_table *table = &context->jobs;
+	for (int i = 0; i < table->count; i++) {
+		free(table->jobs[i].procs);
+		free(table->jobs[i].text);
+	}
+	table->count = 0;
+	table->next_id = 0;
+}
+
+// Wait for every job still running, then forget them all.
+void jobs_free(struct context *context) {
+	struct job_table *table = &context->jobs;
+	for (int i = 0; i < table->count; i++) {
+		struct job *job = &table->jobs[i];
+		for (int j = 0; j < job->nprocs; j++) {
+			int status;
+			if (!job->procs[j].done && waitpid(job->procs[j].pid, &status, 0) == -1 && errno != ECHILD)
+				perror("waitpid");
+		}
+	}
+	jobs_forget(context);
+	free(table->jobs);
+	if (table->watching)
+		close(table->sigchld_fd);
+	memset(table, 0, sizeof(*table));
+}
+
+// Block until job finishes and return its status, removing it from the table.
+static int job_wait(struct context *context, struct job *job) {
+	for (int i = 0; i < job->nprocs && !job->done; i++) {
+		struct job_proc *proc = &job->procs[i];
+		if (proc->done)
+			continue;
+		int status;
+		pid_t pid;
+		while ((pid = waitpid(proc->pid, &status, 0)) == -1 && errno == EINTR)
+			;
+		if (pid == -1) {
+			perror("waitpid");
+			job_remove(&context->jobs, job);
+			return 127;
+		}
+		job_proc_done(context, job, proc, status);
+	}
+	int rc = wait_status_rc(job->pid, job->status);
+	job_remove(&context->jobs, job);
+	return rc;
+}
+
+// wait [-n] [pid|%job ...]: wait for the given jobs and return the last one's status, for
+// whichever job finishes next (-n), or for all jobs.
+int builtin_wait(struct context *context, char **argv, int argc) {
+	struct job_table *table = &context->jobs;
+	if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+		while (table->count > 0) {
+			jobs_poll(context);
+			for (int i = 0; i < table->count; i++) {
+				if (table->jobs[i].done)
+					return job_wait(context, &table->jobs[i]);
+			}
+			jobs_sleep(context);
+		}
+		return 127;
+	}
+
+	if (argc == 1) {
+		while (table->count > 0)
+			job_wait(context, &table->jobs[0]);
+		return 0;
+	}
+
+	int rc = 0;
+	for (int i = 1; i < argc; i++) {
+		struct job *job = job_find_arg(table, argv[i]);
+		if (job == NULL) {
+			fprintf(stderr, "wait: %s: no such job\n", argv[i]);
+			rc = 127;
+			continue;
+		}
+		rc = job_wait(context, job);
+	}
+	return rc;
+}
+
+// jobs: list background jobs and whether they're still running.
+int builtin_jobs(struct context *context, char **argv, int argc) {
+	(void)argv; (void)argc;
+	jobs_poll(context);
+	for (int i = 0; i < context->jobs.count; i++)
+		print_job(stdout, &context->jobs.jobs[i]);
+	return 0;
+}
+
+static void print_job_words(FILE *f, const struct words *words) {
+	for (const struct word *w = words->first; w != NULL; w = w->next)
+		fprintf(f, "%s%s%s", w == words->first ? "" : " ", w->is_var ? "$" : "", w->text);
+}
+
+// A one-line description of a background statement for jobs to show, e.g. "sleep 5 | cat".
+char *statement_text(const struct statement *statement) {
+	char *text = NULL;
+	size_t size = 0;
+	FILE *f = open_memstream(&text, &size);
+	if (f == NULL)
+		return NULL;
+	if (statement->pipe_stream) {
+		for (const struct program *p = statement->pipe_stream->first; p != NULL; p = p->next) {
+			if (p != statement->pipe_stream->first)
+				fprintf(f, " | ");
+			print_job_words(f, p->words);
+		}
+	} else if (statement->for_loop) {
+		fprintf(f, "for %s in ...", statement->for_loop->var_name->text);
+	} else if (statement->while_loop) {
+		fprintf(f, "%s ...", statement->while_loop->until ? "until" : "while");
+	} else if (statement->conditional) {
+		fprintf(f, "if ...");
+	} else if (statement->var_assign) {
+		fprintf(f, "%s=...", statement->var_assign->var_name);
+	}
+	fclose(f);
+	return text;
+}
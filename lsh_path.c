@@ -0,0 +1,154 @@
+// Command name -> executable path cache, so a command run in a loop doesn't walk $PATH
+// with failed exec attempts on every iteration. Misses are cached too, but only briefly,
+// so a command installed while the shell runs is picked up soon after.
+
+#define _GNU_SOURCE	// strchrnul(), tdestroy()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <search.h>
+#include <sys/stat.h>
+
+#include "lsh_ast.h"
+
+#define DEFAULT_PATH		"/usr/local/bin:/usr/bin:/bin"
+#define NEGATIVE_TTL_SEC	2
+
+struct path_cache_entry {
+	char *name;
+	char *path;		// NULL if not found.
+	time_t expires;		// For negative entries.
+	int hits;
+};
+
+static int path_cache_compare(const void *a, const void *b) {
+	return strcmp(((const struct path_cache_entry *)a)->name, ((const struct path_cache_entry *)b)->name);
+}
+
+static time_t monotonic_sec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static void free_path_cache_entry(void *p) {
+	struct path_cache_entry *e = p;
+	free(e->name);
+	free(e->path);
+	free(e);
+}
+
+// Search $PATH for an executable regular file called name. Returns a malloc'd path or NULL.
+static char *path_search(const struct context *context, const char *name) {
+	const char *path = context_get_var(context, "PATH");
+	if (path == NULL)
+		path = DEFAULT_PATH;
+
+	size_t name_len = strlen(name);
+	char *buf = malloc(strlen(path) + name_len + 3);
+	for (const char *dir = path; ; ) {
+		const char *end = strchrnul(dir, ':');
+		size_t dir_len = end - dir;
+		if (dir_len == 0) {
+			buf[0] = '.';	// An empty PATH element means the current directory.
+			dir_len = 1;
+		} else {
+			memcpy(buf, dir, dir_len);
+		}
+		buf[dir_len] = '/';
+		memcpy(buf + dir_len + 1, name, name_len + 1);
+
+		struct stat st;
+		if (stat(buf, &st) == 0 && S_ISREG(st.st_mode) && access(buf, X_OK) == 0)
+			return buf;
+		if (*end == 0)
+			break;
+		dir = end + 1;
+	}
+	free(buf);
+	return NULL;
+}
+
+static struct path_cache_entry *path_cache_find(const struct context *context, const char *name) {
+	struct path_cache_entry key = { .name = (char *)name };
+	void *t = tfind(&key, &context->path_cache, path_cache_compare);
+	return t ? *(struct path_cache_entry **)t : NULL;
+}
+
+// Resolve a command name to the path to exec. Names containing a '/' are used as-is.
+// Returns NULL if the command can't be found.
+const char *path_cache_lookup(struct context *context, const char *name) {
+	if (strchr(name, '/') != NULL)
+		return name;
+
+	struct path_cache_entry *e = path_cache_find(context, name);
+	if (e != NULL && (e->path != NULL || monotonic_sec() < e->expires)) {
+		e->hits++;
+		return e->path;
+	}
+
+	if (e == NULL) {
+		e = calloc(1, sizeof(*e));
+		e->name = strdup(name);
+		tsearch(e, &context->path_cache, path_cache_compare);
+	}
+	e->path = path_search(context, name);
+	e->expires = monotonic_sec() + NEGATIVE_TTL_SEC;
+	e->hits = 1;
+	return e->path;
+}
+
+// Drop a single command, e.g. because its cached path no longer exists.
+void path_cache_forget(struct context *context, const char *name) {
+	struct path_cache_entry *e = path_cache_find(context, name);
+	if (e == NULL)
+		return;
+	tdelete(e, &context->path_cache, path_cache_compare);
+	free_path_cache_entry(e);
+}
+
+// Forget everything, e.g. because $PATH changed.
+void path_cache_clear(struct context *context) {
+	tdestroy(context->path_cache, free_path_cache_entry);
+	context->path_cache = NULL;
+}
+
+static void print_path_cache_entry(const void *nodep, VISIT which, int depth) {
+	(void)depth;
+	const struct path_cache_entry *e = *(const struct path_cache_entry * const *)nodep;
+	if ((which == postorder || which == leaf) && e->path != NULL)
+		printf("%4d\t%s\n", e->hits, e->path);
+}
+
+// hash [-r] [name ...]: list the cache, clear it, or look up names ahead of time.
+int builtin_hash(struct context *context, char **argv, int argc) {
+	int rc = 0;
+	if (argc == 1) {
+		if (context->path_cache == NULL) {
+			printf("hash: hash table empty\n");
+			return 0;
+		}
+		printf("hits\tcommand\n");
+		twalk(context->path_cache, print_path_cache_entry);
+		return 0;
+	}
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-r") == 0) {
+			path_cache_clear(context);
+		} else {
+			// Re-resolve the name; looking it up with hash doesn't count as a use.
+			path_cache_forget(context, argv[i]);
+			if (path_cache_lookup(context, argv[i]) == NULL) {
+				fprintf(stderr, "hash: %s: not found\n", argv[i]);
+				rc = 1;
+			}
+			struct path_cache_entry *e = path_cache_find(context, argv[i]);
+			if (e != NULL)
+				e->hits = 0;
+		}
+	}
+	return rc;
+}
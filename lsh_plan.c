@@ -0,0 +1,460 @@
+// Compiles a parsed script into a flat execution plan and runs it.
+//
+// Control flow (conditionals, loops, background statements) is lowered to jumps over a
+// contiguous instruction array, so running a loop body doesn't re-walk the AST's linked
+// lists. The compiler also prebuilds the argv of every program and for-loop list that has
+// no variables in it, so only argvs that can change are rebuilt when they run.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "lsh_ast.h"
+
+// The shell's descriptors and read buffer as they were before an OP_REDIRECT.
+struct redirect_frame {
+	struct read_buffer input;
+	int nsaved;
+	struct saved_fd saved[];
+};
+
+// The argv of a word list, if it can't change from one run to the next. A list with variables
+// is expanded per run, but make_argv() points its literal slots at the words' text rather than
+// copying them, so only the variable positions cost anything.
+static struct argv_buf *prebuild_argv(struct context *context, const struct words *words) {
+	for (const struct word *w = words->first; w != NULL; w = w->next) {
+		if (!word_is_literal(w))
+			return NULL;
+	}
+	return make_argv(context, &context->arena, words);
+}
+
+static int emit(struct plan *plan, enum plan_op op) {
+	if (plan->len == plan->capacity) {
+		plan->capacity = plan->capacity ? plan->capacity * 2 : 64;
+		plan->code = realloc(plan->code, plan->capacity * sizeof(struct instr));
+		if (plan->code == NULL) {
+			fprintf(stderr, "realloc() failed for plan!\n");
+			exit(1);
+		}
+	}
+	struct instr *in = &plan->code[plan->len];
+	memset(in, 0, sizeof(*in));
+	in->op = op;
+	return plan->len++;
+}
+
+// `cat FILE | ...` only copies FILE into a pipe. Note FILE so the second stage can read it
+// directly instead, see spawn_pipe_stream().
+static void elide_cat(struct pipe_stream *pipe_stream) {
+	const struct program *first = pipe_stream->first;
+	const struct word *cmd = first->words->first;
+	const struct word *file = cmd->next;
+	if (first->next == NULL || first->redirects != NULL || cmd->is_var || strcmp(cmd->text, "cat") != 0)
+		return;
+	if (file == NULL || file->next != NULL || !word_is_literal(file) || file->text[0] == '-')
+		return;
+	pipe_stream->input = file->text;
+}
+
+static void compile_script(struct context *context, struct plan *plan, const struct script *script);
+
+// The script of a $(...) word is compiled out of line, jumped over, and run from there when
+// the word is expanded, see lsh_subst.c
+static void compile_word(struct context *context, struct plan *plan, struct word *word) {
+	if (word->cmdsub == NULL)
+		return;
+	int jump = emit(plan, OP_JUMP);
+	word->cmdsub_start = plan->len;
+	compile_script(context, plan, word->cmdsub);
+	word->cmdsub_end = plan->len;
+	plan->code[jump].target = plan->len;
+}
+
+static void compile_words(struct context *context, struct plan *plan, struct words *words) {
+	for (struct word *w = words->first; w != NULL; w = w->next)
+		compile_word(context, plan, w);
+}
+
+// Redirection targets are expanded like words, e.g. `> $(date +%F).log`.
+static void compile_redirects(struct context *context, struct plan *plan, struct redirects *redirects) {
+	for (struct redirect *r = redirects ? redirects->first : NULL; r != NULL; r = r->next) {
+		if (r->target != NULL)
+			compile_word(context, plan, r->target);
+	}
+}
+
+static void compile_pipe_stream(struct context *context, struct plan *plan, struct pipe_stream *pipe_stream) {
+	for (struct program *p = pipe_stream->first; p != NULL; p = p->next) {
+		compile_words(context, plan, p->words);
+		compile_redirects(context, plan, p->redirects);
+		p->argv = prebuild_argv(context, p->words);
+	}
+	elide_cat(pipe_stream);
+}
+
+static void compile_conditional(struct context *context, struct plan *plan, const struct conditional *conditional) {
+	// Each taken branch jumps to the end, chained through the jumps' targets until patched.
+	int end_jumps = -1;
+	for (const struct conditional_part *cp = conditional->first; cp != NULL; cp = cp->next) {
+		compile_pipe_stream(context, plan, cp->predicate);
+		int test = emit(plan, OP_TEST);
+		plan->code[test].pipe_stream = cp->predicate;
+		compile_script(context, plan, cp->if_true_block);
+		int jump = emit(plan, OP_JUMP);
+		plan->code[jump].target = end_jumps;
+		end_jumps = jump;
+		plan->code[test].target = plan->len;
+	}
+	if (conditional->else_block != NULL) {
+		compile_script(context, plan, conditional->else_block);
+	} else {
+		// No branch taken is a success.
+		emit(plan, OP_STATUS);
+	}
+	while (end_jumps != -1) {
+		int next = plan->code[end_jumps].target;
+		plan->code[end_jumps].target = plan->len;
+		end_jumps = next;
+	}
+}
+
+static void compile_for_loop(struct context *context, struct plan *plan, struct for_loop *for_loop) {
+	if (for_loop->var_values != NULL) {
+		compile_words(context, plan, for_loop->var_values);
+		for_loop->values = prebuild_argv(context, for_loop->var_values);
+	}
+
+	if (for_loop->parallel) {
+		int pdo = emit(plan, OP_PDO);
+		plan->code[pdo].for_loop = for_loop;
+		compile_script(context, plan, for_loop->script);
+		plan->code[pdo].target = plan->len;
+		return;
+	}
+
+	int init = emit(plan, OP_FOR);
+	plan->code[init].for_loop = for_loop;
+	int next = emit(plan, OP_NEXT);
+	plan->code[next].for_loop = for_loop;
+	compile_script(context, plan, for_loop->script);
+	int jump = emit(plan, OP_JUMP);
+	plan->code[jump].target = next;
+	plan->code[next].target = plan->len;
+}
+
+// The predicate is run before each iteration, jumped back to at the end of the body. The
+// loop's redirects are applied to the shell around all of it.
+static void compile_while_loop(struct context *context, struct plan *plan, const struct while_loop *while_loop) {
+	int redirect = -1;
+	if (while_loop->redirects != NULL) {
+		compile_redirects(context, plan, while_loop->redirects);
+		redirect = emit(plan, OP_REDIRECT);
+		plan->code[redirect].redirects = while_loop->redirects;
+	}
+	int top = plan->len;
+	compile_pipe_stream(context, plan, while_loop->predicate);
+	int test = emit(plan, OP_WHILE);
+	plan->code[test].pipe_stream = while_loop->predicate;
+	plan->code[test].while_loop = while_loop;
+	compile_script(context, plan, while_loop->script);
+	int jump = emit(plan, OP_JUMP);
+	plan->code[jump].target = top;
+	plan->code[test].target = plan->len;
+	if (redirect != -1) {
+		int restore = emit(plan, OP_RESTORE);
+		plan->code[restore].target = redirect;
+		plan->code[redirect].target = plan->len;
+	}
+}
+
+static void compile_statement(struct context *context, struct plan *plan, const struct statement *statement) {
+	int bg = -1;
+	if (statement->background) {
+		bg = emit(plan, OP_BG);
+		plan->code[bg].statement = statement;
+	}
+
+	if (statement->conditional)
+		compile_conditional(context, plan, statement->conditional);
+	if (statement->pipe_stream) {
+		compile_pipe_stream(context, plan, statement->pipe_stream);
+		int pipe = emit(plan, OP_PIPE);
+		plan->code[pipe].pipe_stream = statement->pipe_stream;
+	}
+	if (statement->for_loop)
+		compile_for_loop(context, plan, statement->for_loop);
+	if (statement->while_loop)
+		compile_while_loop(context, plan, statement->while_loop);
+	if (statement->var_assign) {
+		compile_words(context, plan, statement->var_assign->var_value);
+		int assign = emit(plan, OP_ASSIGN);
+		plan->code[assign].var_assign = statement->var_assign;
+	}
+
+	// The background child runs the statement's instructions, the shell skips them.
+	if (bg != -1)
+		plan->code[bg].target = plan->len;
+}
+
+static void compile_script(struct context *context, struct plan *plan, const struct script *script) {
+	for (const struct statement *s = script->first; s; s = s->next)
+		compile_statement(context, plan, s);
+}
+
+// Lower script into context->plan, replacing whatever was there.
+void compile_plan(struct context *context, const struct script *script) {
+	context->plan.len = 0;
+	compile_script(context, &context->plan, script);
+}
+
+// Whether a stage could read the shell's stdin from a process of its own: any program that
+// is first in its pipeline and whose stdin isn't redirected, except a builtin, which runs in
+// the shell. read is the exception when it's forked to run alongside later stages.
+static int program_shares_stdin(const struct program *program) {
+	const struct word *argv0 = program->words->first;
+	if (redirects_stdin(program->redirects))
+		return 0;
+	if (argv0->is_var || argv0->cmdsub || !is_builtin(argv0->text))
+		return 1;
+	return program->next != NULL && strcmp(argv0->text, "read") == 0;
+}
+
+// Let `while read ...` loops read stdin in blocks, see lsh_read.c, if nothing in the plan could
+// start a process sharing stdin. Background statements and pdo iterations run in copies of the
+// shell, so they could.
+static void plan_buffer_stdin(struct plan *plan) {
+	for (int pc = 0; pc < plan->len; pc++) {
+		const struct instr *in = &plan->code[pc];
+		if (in->op == OP_BG || in->op == OP_PDO)
+			return;
+		// An elided `cat FILE` never runs, and the stage after it reads FILE.
+		if (in->pipe_stream != NULL && in->pipe_stream->input == NULL && program_shares_stdin(in->pipe_stream->first))
+			return;
+	}
+	for (int pc = 0; pc < plan->len; pc++) {
+		struct instr *in = &plan->code[pc];
+		if (in->op != OP_WHILE || in->while_loop->until || in->pipe_stream->first->next != NULL)
+			continue;
+		const struct word *argv0 = in->pipe_stream->first->words->first;
+		in->buffered = !argv0->is_var && !argv0->cmdsub && strcmp(argv0->text, "read") == 0;
+	}
+}
+
+// Compile a single top-level statement into context->plan and run it.
+int run_statement(struct context *context, const struct statement *statement) {
+	context->plan.len = 0;
+	glob_cache_clear(context);
+	stat_cache_clear(context);
+	compile_statement(context, &context->plan, statement);
+	plan_buffer_stdin(&context->plan);
+
+	long long start = context->trace != NULL ? trace_now() : 0;
+	int rc = run_plan(context, 0, context->plan.len);
+	read_buffer_release(context);
+	if (context->trace != NULL)
+		trace_statement(context, statement, start, trace_now(), rc);
+	return rc;
+}
+
+// Number of pdo iterations allowed to run at once: $LSH_JOBS (also set by -j), or the online CPU count.
+static int context_max_jobs(const struct context *context) {
+	const char *s = context_get_var(context, "LSH_JOBS");
+	long n = s ? strtol(s, NULL, 10) : 0;
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
+
+// Run each iteration of a pdo loop (the instructions [start, end)) in its own forked copy of
+// the shell, keeping at most context_max_jobs() of them alive. Every iteration is reaped before
+// returning. The result is 0 if all iterations succeeded, otherwise the status of the first
+// failing iteration.
+static int run_parallel_for_loop(struct context *context, const struct for_loop *for_loop, const struct argv_buf *buf, int start, int end) {
+	int max_jobs = context_max_jobs(context);
+	pid_t *pids = calloc(buf->argc, sizeof(pid_t));
+	int running = 0, next = 0, failed = buf->argc, rc = 0;
+	stat_cache_clear(context);
+
+	while (next < buf->argc || running > 0) {
+		if (next < buf->argc && running < max_jobs) {
+			fflush(NULL);	// Don't let the child re-emit our buffered output.
+			pid_t pid = fork();
+			if (pid == 0) {
+				jobs_forget(context);
+				context_set_slot(context, for_loop->var_name->slot, buf->argv[next]);
+				exit(run_plan(context, start, end) & 0xff);
+			}
+			if (pid != -1) {
+				pids[next++] = pid;
+				running++;
+				continue;
+			}
+			perror("fork");
+			if (running == 0) {
+				rc = -1;
+				break;
+			}
+		}
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid == -1) {
+			if (errno == EINTR) continue;
+			perror("waitpid");
+			rc = -1;
+			break;
+		}
+		int i;
+		for (i = 0; i < next && pids[i] != pid; i++)
+			;
+		if (i == next) {
+			// One of our background jobs finished while we were waiting.
+			jobs_reaped(context, pid, status);
+			continue;
+		}
+		running--;
+		int child_rc = wait_status_rc(pid, status);
+		if (child_rc != 0 && i < failed) {
+			failed = i;
+			rc = child_rc;
+		}
+	}
+
+	free(pids);
+	return rc;
+}
+
+static struct argv_buf *for_loop_values(struct context *context, const struct for_loop *for_loop) {
+	if (for_loop->values != NULL)
+		return for_loop->values;
+	if (for_loop->var_values == NULL)
+		return NULL;
+	return make_argv(context, &context->scratch, for_loop->var_values);
+}
+
+static void for_loop_values_done(struct context *context, const struct for_loop *for_loop, struct argv_buf *buf) {
+	if (buf != NULL && buf != for_loop->values)
+		free_argv(context, buf);
+}
+
+// Run the plan's instructions [pc, end) and return the status of the last statement.
+int run_plan(struct context *context, int pc, int end) {
+	struct instr *code = context->plan.code;
+	while (pc < end) {
+		struct instr *in = &code[pc];
+		switch (in->op) {
+		case OP_PIPE:
+			context_set_status(context, run_pipe_stream(context, in->pipe_stream));
+			pc++;
+			break;
+		case OP_TEST:
+			context_set_status(context, run_pipe_stream(context, in->pipe_stream));
+			pc = context->last_status == 0 ? pc + 1 : in->target;
+			break;
+		case OP_ASSIGN:
+			context_set_status(context, run_var_assign(context, in->var_assign));
+			pc++;
+			break;
+		case OP_STATUS:
+			context_set_status(context, 0);
+			pc++;
+			break;
+		case OP_JUMP:
+			// A loop going round again may be waiting for a file to change, see lsh_test.c
+			if (in->target < pc)
+				stat_cache_clear(context);
+			pc = in->target;
+			break;
+		case OP_FOR:
+			// Loop state lives on the OP_NEXT that follows.
+			code[pc + 1].values = for_loop_values(context, in->for_loop);
+			code[pc + 1].next = 0;
+			context_set_status(context, 0);
+			if (code[pc + 1].values != NULL && code[pc + 1].values->failed) {
+				for_loop_values_done(context, in->for_loop, code[pc + 1].values);
+				code[pc + 1].values = NULL;
+				context_set_status(context, 1);
+			}
+			pc++;
+			break;
+		case OP_NEXT:
+			if (in->values != NULL && in->next < in->values->argc) {
+				context_set_slot(context, in->for_loop->var_name->slot, in->values->argv[in->next++]);
+				pc++;
+			} else {
+				for_loop_values_done(context, in->for_loop, in->values);
+				in->values = NULL;
+				pc = in->target;
+			}
+			break;
+		case OP_WHILE: {
+			// The loop's status is that of the body's last statement, or 0 if it never ran.
+			int body_rc = in->next ? context->last_status : 0;
+			if (in->buffered)
+				context->input.buffered = 1;
+			int rc = run_pipe_stream(context, in->pipe_stream);
+			if ((rc == 0) != in->while_loop->until) {
+				context_set_status(context, rc);
+				in->next = 1;
+				pc++;
+			} else {
+				context_set_status(context, body_rc);
+				in->next = 0;
+				if (in->buffered)
+					context->input.buffered = 0;
+				pc = in->target;
+			}
+			break;
+		}
+		case OP_REDIRECT: {
+			// Like a builtin's, but for every command in the loop. read gets a buffer of its
+			// own for the new stdin, which nothing else reads if the old one had no sharers.
+			struct redirect_frame *frame = arena_alloc(&context->scratch, sizeof(struct redirect_frame) + redirects_count(in->redirects) * sizeof(struct saved_fd));
+			int buffered = context->input.buffered;
+			read_buffer_push(context, &frame->input);
+			context->input.buffered = buffered;
+			if (redirect_shell(context, in->redirects, frame->saved, &frame->nsaved) == -1) {
+				redirect_restore(frame->saved, frame->nsaved);
+				read_buffer_pop(context, &frame->input);
+				arena_release(&context->scratch, frame);
+				context_set_status(context, 1);
+				pc = in->target;
+				break;
+			}
+			in->frame = frame;
+			pc++;
+			break;
+		}
+		case OP_RESTORE: {
+			struct redirect_frame *frame = code[in->target].frame;
+			redirect_restore(frame->saved, frame->nsaved);
+			read_buffer_pop(context, &frame->input);
+			arena_release(&context->scratch, frame);
+			pc++;
+			break;
+		}
+		case OP_PDO: {
+			struct argv_buf *values = for_loop_values(context, in->for_loop);
+			int rc = values && values->failed ? 1 : values ? run_parallel_for_loop(context, in->for_loop, values, pc + 1, in->target) : 0;
+			for_loop_values_done(context, in->for_loop, values);
+			context_set_status(context, rc);
+			pc = in->target;
+			break;
+		}
+		case OP_BG:
+			run_bg_statement(context, in->statement, pc + 1, in->target);
+			context_set_status(context, 0);
+			pc = in->target;
+			break;
+		}
+	}
+	return context->last_status;
+}
+
+void free_plan(struct plan *plan) {
+	free(plan->code);
+	memset(plan, 0, sizeof(*plan));
+}
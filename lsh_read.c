@@ -0,0 +1,200 @@
+// The read builtin: read [-r] [name ...] reads a line from stdin and splits it into the named
+// variables (REPLY if there are none) at spaces and tabs, the last one getting the rest of the
+// line. Without -r, a backslash quotes the character after it and one at the end of the line
+// continues it onto the next.
+//
+// A shell can't normally read stdin ahead of the line it wants: whatever it takes past the
+// newline is gone for the next command that reads stdin. So read takes a byte at a time,
+// except in a `while read ...` loop in a top-level statement that starts no process that
+// could read stdin (see plan_buffer_stdin()). There stdin is read in READ_BUFFER blocks, so
+// a stream of any size is processed with one read() per block and in constant memory. Such a
+// loop only ends at the end of input, when nothing is left over. Anything that is, e.g. from
+// a read after the loop in the same statement, is given back by seeking if stdin can seek,
+// and otherwise kept for the next read.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "lsh_ast.h"
+
+#define READ_BUFFER	65536
+
+// Refill the buffer, with a block or just a byte. Returns 0 at the end of input.
+static int read_buffer_fill(struct read_buffer *in) {
+	if (in->data == NULL && (in->data = malloc(READ_BUFFER)) == NULL) {
+		fprintf(stderr, "malloc() failed for read buffer!\n");
+		exit(1);
+	}
+	ssize_t n;
+	while ((n = read(STDIN_FILENO, in->data, in->buffered ? READ_BUFFER : 1)) == -1 && errno == EINTR)
+		;
+	if (n == -1) {
+		perror("read");
+		n = 0;
+	}
+	in->pos = 0;
+	in->len = n;
+	return n > 0;
+}
+
+static void line_append(struct read_buffer *in, size_t *len, const char *s, size_t n) {
+	if (*len + n + 1 > in->line_capacity) {
+		in->line_capacity = (*len + n + 1) * 2;
+		in->line = realloc(in->line, in->line_capacity);
+		if (in->line == NULL) {
+			fprintf(stderr, "realloc() failed for read!\n");
+			exit(1);
+		}
+	}
+	memcpy(in->line + *len, s, n);
+	*len += n;
+	in->line[*len] = 0;
+}
+
+// Whether line ends in an unquoted backslash.
+static int line_continues(const char *line, size_t len) {
+	size_t n = 0;
+	while (n < len && line[len - n - 1] == '\\')
+		n++;
+	return n % 2 == 1;
+}
+
+// Read a line into in->line, without its newline. Returns 0 if the line ended with one, 1 if
+// it ended at the end of input, and -1 if there was no line at all.
+static int read_line(struct read_buffer *in, int raw) {
+	size_t len = 0;
+	int got = 0;
+	line_append(in, &len, "", 0);
+	for (;;) {
+		if (in->pos == in->len && !read_buffer_fill(in))
+			return got ? 1 : -1;
+		got = 1;
+		char *start = in->data + in->pos;
+		char *nl = memchr(start, '\n', in->len - in->pos);
+		size_t n = nl != NULL ? (size_t)(nl - start) : in->len - in->pos;
+		line_append(in, &len, start, n);
+		in->pos += n + (nl != NULL);
+		if (nl == NULL)
+			continue;
+		if (!raw && line_continues(in->line, len)) {
+			in->line[--len] = 0;
+			continue;
+		}
+		return 0;
+	}
+}
+
+static int is_blank(char c) {
+	return c == ' ' || c == '\t';
+}
+
+static int is_name(const char *s) {
+	if (!isalpha((unsigned char)*s) && *s != '_')
+		return 0;
+	while (isalnum((unsigned char)*s) || *s == '_')
+		s++;
+	return *s == 0;
+}
+
+// Split line in place into n fields, the last taking the rest of the line. Quoting backslashes
+// are removed as it goes, which only ever moves text left.
+static void split_line(char *line, int raw, const char **fields, int n) {
+	char *r = line, *w = line;
+	for (int i = 0; i < n; i++) {
+		int last = i == n - 1;
+		while (is_blank(*r))
+			r++;
+		if (*r == 0) {
+			fields[i] = "";
+			continue;
+		}
+		char *start = w, *quoted = w;
+		while (*r && (last || !is_blank(*r))) {
+			if (!raw && r[0] == '\\' && r[1] != 0) {
+				*w++ = r[1];
+				r += 2;
+				quoted = w;
+			} else {
+				*w++ = *r++;
+			}
+		}
+		if (last) {
+			while (w > quoted && w > start && is_blank(w[-1]))
+				w--;
+		}
+		if (*r)
+			r++;
+		*w++ = 0;
+		fields[i] = start;
+	}
+}
+
+int builtin_read(struct context *context, char **argv, int argc) {
+	int raw = 0, i = 1;
+	for (; i < argc && argv[i][0] == '-' && argv[i][1] != 0; i++) {
+		if (strcmp(argv[i], "--") == 0) {
+			i++;
+			break;
+		}
+		if (strcmp(argv[i], "-r") != 0) {
+			fprintf(stderr, "read: %s: invalid option\n", argv[i]);
+			return 2;
+		}
+		raw = 1;
+	}
+	char reply_name[] = "REPLY";
+	char *reply[] = { reply_name };
+	char **names = i < argc ? argv + i : reply;
+	int n = i < argc ? argc - i : 1;
+	for (int j = 0; j < n; j++) {
+		if (!is_name(names[j])) {
+			fprintf(stderr, "read: `%s': not a valid identifier\n", names[j]);
+			return 1;
+		}
+	}
+
+	struct read_buffer *in = &context->input;
+	int rc = read_line(in, raw);
+	const char **fields = arena_alloc(&context->scratch, n * sizeof(char *));
+	if (rc == -1) {
+		for (int j = 0; j < n; j++)
+			fields[j] = "";
+	} else {
+		split_line(in->line, raw, fields, n);
+	}
+	for (int j = 0; j < n; j++)
+		context_set_var(context, names[j], fields[j]);
+	arena_release(&context->scratch, fields);
+	return rc == 0 ? 0 : 1;
+}
+
+// At the end of each top-level statement, give back what was read ahead, see above, and go
+// back to reading a byte at a time.
+void read_buffer_release(struct context *context) {
+	struct read_buffer *in = &context->input;
+	if (in->pos < in->len && lseek(STDIN_FILENO, -(off_t)(in->len - in->pos), SEEK_CUR) != -1)
+		in->pos = in->len;
+	in->buffered = 0;
+}
+
+// Set the buffer aside while a builtin's stdin is redirected, so read sees the redirected
+// stdin rather than what was read ahead from the real one.
+void read_buffer_push(struct context *context, struct read_buffer *saved) {
+	*saved = context->input;
+	memset(&context->input, 0, sizeof(context->input));
+}
+
+void read_buffer_pop(struct context *context, struct read_buffer *saved) {
+	read_buffer_free(context);
+	context->input = *saved;
+}
+
+void read_buffer_free(struct context *context) {
+	free(context->input.data);
+	free(context->input.line);
+	memset(&context->input, 0, sizeof(context->input));
+}
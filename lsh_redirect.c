@@ -0,0 +1,141 @@
+// I/O redirection: <, >, >>, N<, N>, N>> and N>&M. For a program, the files are opened in
+// the shell and put in place with spawn file actions, after the pipeline's own pipe ends, so
+// e.g. `cmd 2>&1 | grep x` sends stderr down the pipe. A builtin runs in the shell, so for it
+// the shell's own descriptors are swapped around the call and put back afterwards.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lsh_ast.h"
+
+// A redirection from its operator as lexed, e.g. ">", "2>>" or "2>&1", and its file, if any.
+struct redirect *parse_redirect(struct arena *arena, const char *op, struct word *target) {
+	struct redirect *r = new_redirect(arena);
+	r->fd = *op == '<' ? STDIN_FILENO : STDOUT_FILENO;
+	if (isdigit((unsigned char)*op))
+		r->fd = *op++ - '0';
+	if (op[0] == '<')
+		r->op = REDIR_IN;
+	else if (op[1] == '>')
+		r->op = REDIR_APPEND;
+	else if (op[1] == '&')
+		r->op = REDIR_DUP;
+	else
+		r->op = REDIR_OUT;
+	if (r->op == REDIR_DUP)
+		r->dup_fd = atoi(op + 2);
+	r->target = target;
+	return r;
+}
+
+int redirects_count(const struct redirects *redirects) {
+	int n = 0;
+	for (const struct redirect *r = redirects->first; r != NULL; r = r->next)
+		n++;
+	return n;
+}
+
+// Whether redirects (may be NULL) replace stdin.
+int redirects_stdin(const struct redirects *redirects) {
+	for (const struct redirect *r = redirects ? redirects->first : NULL; r != NULL; r = r->next) {
+		if (r->fd == STDIN_FILENO)
+			return 1;
+	}
+	return 0;
+}
+
+// Open a redirection's file, close-on-exec. Returns -1, having said why, if it can't be.
+// The target is expanded like a command's word, and must come to exactly one field, as in sh.
+static int open_redirect(struct context *context, const struct redirect *r) {
+	const char *path = r->target->text;
+	struct argv_buf *argv = NULL;
+	if (!word_is_literal(r->target)) {
+		struct words target = { r->target, r->target };
+		argv = make_argv(context, &context->scratch, &target);
+		if (argv->failed || argv->argc != 1) {
+			if (!argv->failed)
+				fprintf(stderr, "%s%s: ambiguous redirect\n", r->target->is_var ? "$" : "", r->target->text);
+			free_argv(context, argv);
+			return -1;
+		}
+		path = argv->argv[0];
+	}
+	int flags = O_CLOEXEC;
+	if (r->op == REDIR_IN)
+		flags |= O_RDONLY;
+	else
+		flags |= O_WRONLY | O_CREAT | (r->op == REDIR_APPEND ? O_APPEND : O_TRUNC);
+	int fd = open(path, flags, 0666);
+	if (fd == -1)
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	if (argv != NULL)
+		free_argv(context, argv);
+	return fd;
+}
+
+// Open the files redirects names and add dup2()s putting them in place to actions. The opened
+// descriptors are stored in fds (redirects_count() of them at most), for the caller to close
+// once the program has been spawned. Returns how many were stored, or -1 if a file couldn't
+// be opened, in which case none are left open.
+int redirect_file_actions(struct context *context, const struct redirects *redirects, posix_spawn_file_actions_t *actions, int *fds) {
+	int n = 0;
+	for (const struct redirect *r = redirects->first; r != NULL; r = r->next) {
+		if (r->op == REDIR_DUP) {
+			posix_spawn_file_actions_adddup2(actions, r->dup_fd, r->fd);
+			continue;
+		}
+		int fd = open_redirect(context, r);
+		if (fd == -1) {
+			while (n > 0)
+				close(fds[--n]);
+			return -1;
+		}
+		fds[n++] = fd;
+		posix_spawn_file_actions_adddup2(actions, fd, r->fd);
+	}
+	return n;
+}
+
+// Apply redirects to the shell itself, for a builtin. Each descriptor is first copied into
+// saved (redirects_count() entries), for redirect_restore() to put back. Returns -1, having
+// said why, if one couldn't be applied; the ones before it still need restoring.
+int redirect_shell(struct context *context, const struct redirects *redirects, struct saved_fd *saved, int *nsaved) {
+	fflush(NULL);	// Output already written by the shell goes where it was meant to.
+	*nsaved = 0;
+	for (const struct redirect *r = redirects->first; r != NULL; r = r->next) {
+		int fd = r->op == REDIR_DUP ? r->dup_fd : open_redirect(context, r);
+		if (fd == -1)
+			return -1;
+		saved[*nsaved].fd = r->fd;
+		saved[*nsaved].copy = fcntl(r->fd, F_DUPFD_CLOEXEC, 10);	// -1 if r->fd wasn't open.
+		(*nsaved)++;
+		int rc = dup2(fd, r->fd);
+		int err = errno;
+		if (r->op != REDIR_DUP && fd != r->fd)
+			close(fd);
+		if (rc == -1) {
+			// fd is the M of N>&M, or the file that was opened.
+			fprintf(stderr, "%d: %s\n", fd, strerror(err));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Undo redirect_shell(), last redirection first.
+void redirect_restore(struct saved_fd *saved, int nsaved) {
+	fflush(NULL);
+	while (nsaved-- > 0) {
+		if (saved[nsaved].copy == -1) {
+			close(saved[nsaved].fd);
+		} else {
+			dup2(saved[nsaved].copy, saved[nsaved].fd);
+			close(saved[nsaved].copy);
+		}
+	}
+}
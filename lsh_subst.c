@@ -0,0 +1,158 @@
+// Command substitution: $(script) is replaced by what script writes to stdout, less any
+// trailing newlines. Its script is compiled into the plan out of line (see compile_words())
+// and run in the cheapest way that keeps it from changing the shell's own state:
+//
+// - A lone builtin that only writes output, like $(echo ...) or $(pwd), runs in the shell
+//   with stdout pointed at a memory buffer: no fork, no pipe.
+// - A pipeline of programs is spawned with its output on a pipe, as any pipeline would be.
+// - Anything else runs in a forked copy of the shell writing to a pipe.
+//
+// Pipes are read in large blocks straight into the result buffer.
+
+#define _GNU_SOURCE	// pipe2()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "lsh_ast.h"
+
+#define READ_BLOCK	65536
+
+struct capture {
+	int read_fd;
+	int write_fd;
+	char *buf;
+	size_t len;
+	size_t capacity;
+};
+
+// Read fd to EOF into capture's buffer.
+static void capture_read(struct capture *c) {
+	for (;;) {
+		if (c->capacity - c->len < READ_BLOCK) {
+			c->capacity = c->capacity * 2 + READ_BLOCK;
+			c->buf = realloc(c->buf, c->capacity);
+			if (c->buf == NULL) {
+				fprintf(stderr, "realloc() failed for command output!\n");
+				exit(1);
+			}
+		}
+		ssize_t n = read(c->read_fd, c->buf + c->len, c->capacity - c->len - 1);
+		if (n == 0)
+			break;
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			break;
+		}
+		c->len += n;
+	}
+	close(c->read_fd);
+}
+
+// Once a pipeline's stages have their copies of the pipe's write end, close ours and read.
+static void capture_pipe_stream(void *arg) {
+	struct capture *c = arg;
+	close(c->write_fd);
+	capture_read(c);
+}
+
+// The substitution's script if it's a single statement that is just a builtin that only writes
+// output, e.g. $(echo $x). Expanding its words mustn't set variables either, as $((i++)) does.
+static const struct program *pure_builtin(const struct script *script) {
+	const struct statement *s = script->first;
+	if (s != script->last || s->background || s->pipe_stream == NULL || s->pipe_stream->timed)
+		return NULL;
+	const struct program *p = s->pipe_stream->first;
+	const struct word *argv0 = p->words->first;
+	if (p->next != NULL || p->redirects != NULL || argv0->is_var || argv0->cmdsub || !is_pure_builtin(argv0->text))
+		return NULL;
+	for (const struct word *w = argv0->next; w != NULL; w = w->next) {
+		if (arith_assigns(w->arith))
+			return NULL;
+	}
+	return p;
+}
+
+// The substitution's script if it's a single pipeline of programs, e.g. $(date +%s | cut -c1-5).
+static const struct pipe_stream *spawnable_pipe_stream(const struct script *script) {
+	const struct statement *s = script->first;
+	if (s != script->last || s->background || s->pipe_stream == NULL || !pipe_stream_spawnable(s->pipe_stream))
+		return NULL;
+	return s->pipe_stream;
+}
+
+// Run the command substitution word and return its output, malloc'd and without trailing
+// newlines. Its status is stored in *rc.
+char *run_command_subst(struct context *context, const struct word *word, int *rc) {
+	struct capture c = { .read_fd = -1, .write_fd = -1 };
+	const struct program *builtin = pure_builtin(word->cmdsub);
+	const struct pipe_stream *pipe_stream = spawnable_pipe_stream(word->cmdsub);
+
+	if (builtin != NULL) {
+		// stdout is an assignable variable in glibc, so the builtin's writes can go to memory.
+		fflush(stdout);
+		FILE *saved = stdout;
+		FILE *mem = open_memstream(&c.buf, &c.len);
+		if (mem == NULL) {
+			perror("open_memstream");
+			*rc = 1;
+			return strdup("");
+		}
+		stdout = mem;
+		*rc = run_one_program(context, builtin);
+		stdout = saved;
+		fclose(mem);
+	} else {
+		int fds[2];
+		if (pipe2(fds, O_CLOEXEC) == -1) {
+			perror("pipe");
+			*rc = 1;
+			return strdup("");
+		}
+		c.read_fd = fds[0];
+		c.write_fd = fds[1];
+		if (pipe_stream != NULL) {
+			*rc = run_pipe_stream_to(context, pipe_stream, c.write_fd, capture_pipe_stream, &c);
+		} else {
+			fflush(NULL);	// Don't let the child re-emit our buffered output.
+			stat_cache_clear(context);
+			pid_t pid = fork();
+			if (pid == 0) {
+				dup2(c.write_fd, STDOUT_FILENO);
+				jobs_forget(context);
+				exit(run_plan(context, word->cmdsub_start, word->cmdsub_end) & 0xff);
+			}
+			close(c.write_fd);
+			if (pid == -1) {
+				perror("fork");
+				close(c.read_fd);
+				*rc = 1;
+			} else {
+				capture_read(&c);
+				int status;
+				while (waitpid(pid, &status, 0) == -1) {
+					if (errno != EINTR) {
+						perror("waitpid");
+						status = 1 << 8;
+						break;
+					}
+				}
+				*rc = wait_status_rc(pid, status);
+			}
+		}
+	}
+
+	if (c.buf == NULL)
+		return strdup("");
+	while (c.len > 0 && c.buf[c.len - 1] == '\n')
+		c.len--;
+	c.buf[c.len] = 0;
+	return c.buf;
+}
@@ -0,0 +1,226 @@
+// The test and [ builtins: file, string and integer predicates, combined with !, -a and -o.
+// As a builtin, an if or elif predicate like [ -f $file ] runs in the shell with no fork.
+//
+// stat() results are cached, so a predicate that asks several things about one path, or a
+// chain of elifs testing the same one, stats it once. The cache only lasts while nothing but
+// test runs: any other command could change the filesystem, so running one (or starting a
+// new top-level statement) clears it. So does each iteration of a loop, since another
+// process may change the filesystem while it runs, e.g. `while [ ! -f done ]; do ...`.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "lsh_ast.h"
+
+struct stat_entry {
+	char *path;
+	int follow;		// stat() rather than lstat().
+	int rc;			// 0, or the errno it failed with.
+	struct stat st;
+};
+
+// Cleared whenever anything but test runs, see above.
+void stat_cache_clear(struct context *context) {
+	struct stat_cache *cache = &context->stats;
+	for (int i = 0; i < cache->count; i++)
+		free(cache->entries[i].path);
+	cache->count = 0;
+}
+
+void stat_cache_free(struct context *context) {
+	stat_cache_clear(context);
+	free(context->stats.entries);
+	memset(&context->stats, 0, sizeof(context->stats));
+}
+
+// stat() (or lstat() if !follow) path, through the cache. Returns NULL if it failed.
+static const struct stat *cached_stat(struct context *context, const char *path, int follow) {
+	struct stat_cache *cache = &context->stats;
+	for (int i = 0; i < cache->count; i++) {
+		struct stat_entry *e = &cache->entries[i];
+		if (e->follow == follow && strcmp(e->path, path) == 0)
+			return e->rc == 0 ? &e->st : NULL;
+	}
+	if (cache->count == cache->capacity) {
+		cache->capacity = cache->capacity ? cache->capacity * 2 : 8;
+		cache->entries = realloc(cache->entries, cache->capacity * sizeof(struct stat_entry));
+		if (cache->entries == NULL) {
+			fprintf(stderr, "realloc() failed for stat cache!\n");
+			exit(1);
+		}
+	}
+	struct stat_entry *e = &cache->entries[cache->count++];
+	e->path = strdup(path);
+	e->follow = follow;
+	e->rc = (follow ? stat(path, &e->st) : lstat(path, &e->st)) == 0 ? 0 : errno;
+	return e->rc == 0 ? &e->st : NULL;
+}
+
+struct test_parser {
+	struct context *context;
+	const char *name;	// test or [, for error messages.
+	char **argv;
+	int argc;
+	int i;
+	int error;
+};
+
+static int test_error(struct test_parser *tp, const char *arg, const char *why) {
+	if (!tp->error)
+		fprintf(stderr, "%s: %s%s%s\n", tp->name, arg ? arg : "", arg ? ": " : "", why);
+	tp->error = 1;
+	return 0;
+}
+
+static int is_unary(const char *op) {
+	return op[0] == '-' && op[1] != 0 && op[2] == 0 && strchr("bcdefghkLnprsSuwxzt", op[1]) != NULL;
+}
+
+static int is_binary(const char *op) {
+	static const char *const ops[] = { "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef" };
+	for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+		if (strcmp(op, ops[i]) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static long long integer(struct test_parser *tp, const char *s) {
+	char *end;
+	errno = 0;
+	long long n = strtoll(s, &end, 10);
+	while (*end == ' ' || *end == '\t')
+		end++;
+	if (errno != 0 || end == s || *end != 0)
+		test_error(tp, s, "integer expression expected");
+	return n;
+}
+
+static int unary(struct test_parser *tp, char op, const char *arg) {
+	if (op == 'n' || op == 'z')
+		return (*arg != 0) == (op == 'n');
+	if (op == 't')
+		return isatty(integer(tp, arg));
+
+	const struct stat *st = cached_stat(tp->context, arg, op != 'L' && op != 'h');
+	if (st == NULL)
+		return 0;
+	switch (op) {
+	case 'b': return S_ISBLK(st->st_mode);
+	case 'c': return S_ISCHR(st->st_mode);
+	case 'd': return S_ISDIR(st->st_mode);
+	case 'e': return 1;
+	case 'f': return S_ISREG(st->st_mode);
+	case 'g': return (st->st_mode & S_ISGID) != 0;
+	case 'h':
+	case 'L': return S_ISLNK(st->st_mode);
+	case 'k': return (st->st_mode & S_ISVTX) != 0;
+	case 'u': return (st->st_mode & S_ISUID) != 0;
+	case 'p': return S_ISFIFO(st->st_mode);
+	case 'S': return S_ISSOCK(st->st_mode);
+	case 's': return st->st_size > 0;
+	case 'r': return access(arg, R_OK) == 0;
+	case 'w': return access(arg, W_OK) == 0;
+	case 'x': return access(arg, X_OK) == 0;
+	}
+	return 0;
+}
+
+static int newer(const struct stat *a, const struct stat *b) {
+	if (a->st_mtim.tv_sec != b->st_mtim.tv_sec)
+		return a->st_mtim.tv_sec > b->st_mtim.tv_sec;
+	return a->st_mtim.tv_nsec > b->st_mtim.tv_nsec;
+}
+
+static int binary(struct test_parser *tp, const char *a, const char *op, const char *b) {
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+		return strcmp(a, b) == 0;
+	if (strcmp(op, "!=") == 0)
+		return strcmp(a, b) != 0;
+	if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+		const struct stat *sa = cached_stat(tp->context, a, 1);
+		const struct stat *sb = cached_stat(tp->context, b, 1);
+		if (op[1] == 'e')
+			return sa && sb && sa->st_dev == sb->st_dev && sa->st_ino == sb->st_ino;
+		// A file that exists is newer than one that doesn't, as in bash.
+		if (op[1] == 'n')
+			return sa && (!sb || newer(sa, sb));
+		return sb && (!sa || newer(sb, sa));
+	}
+	long long x = integer(tp, a), y = integer(tp, b);
+	if (strcmp(op, "-eq") == 0) return x == y;
+	if (strcmp(op, "-ne") == 0) return x != y;
+	if (strcmp(op, "-lt") == 0) return x < y;
+	if (strcmp(op, "-le") == 0) return x <= y;
+	if (strcmp(op, "-gt") == 0) return x > y;
+	return x >= y;
+}
+
+static int parse_or(struct test_parser *tp);
+
+// A single predicate, or a negated one. Which it is depends on how many arguments are left,
+// as POSIX says: e.g. [ -f ] asks whether "-f" is non-empty and [ = = = ] compares strings.
+static int parse_not(struct test_parser *tp) {
+	int left = tp->argc - tp->i;
+	char **argv = tp->argv + tp->i;
+	if (left <= 0)
+		return test_error(tp, NULL, "argument expected");
+	if (left >= 3 && is_binary(argv[1])) {
+		tp->i += 3;
+		return binary(tp, argv[0], argv[1], argv[2]);
+	}
+	if (strcmp(argv[0], "!") == 0 && left >= 2) {
+		tp->i++;
+		return !parse_not(tp);
+	}
+	if (left >= 2 && is_unary(argv[0])) {
+		tp->i += 2;
+		return unary(tp, argv[0][1], argv[1]);
+	}
+	tp->i++;
+	return argv[0][0] != 0;
+}
+
+static int parse_and(struct test_parser *tp) {
+	int result = parse_not(tp);
+	while (tp->i < tp->argc && strcmp(tp->argv[tp->i], "-a") == 0) {
+		tp->i++;
+		result = parse_not(tp) && result;
+	}
+	return result;
+}
+
+static int parse_or(struct test_parser *tp) {
+	int result = parse_and(tp);
+	while (tp->i < tp->argc && strcmp(tp->argv[tp->i], "-o") == 0) {
+		tp->i++;
+		result = parse_and(tp) || result;
+	}
+	return result;
+}
+
+// test expression, or [ expression ]: 0 if it's true, 1 if not, 2 if it's malformed.
+int builtin_test(struct context *context, char **argv, int argc) {
+	struct test_parser tp = { context, argv[0], argv + 1, argc - 1, 0, 0 };
+	if (strcmp(argv[0], "[") == 0) {
+		if (argc < 2 || strcmp(argv[argc - 1], "]") != 0) {
+			fprintf(stderr, "[: missing ']'\n");
+			return 2;
+		}
+		tp.argc--;
+	}
+	if (tp.argc == 0)
+		return 1;
+	int result = parse_or(&tp);
+	if (!tp.error && tp.i < tp.argc)
+		test_error(&tp, tp.argv[tp.i], "unexpected argument");
+	return tp.error ? 2 : !result;
+}
+
+int is_test_builtin(const char *argv0) {
+	return strcmp(argv0, "test") == 0 || strcmp(argv0, "[") == 0;
+}
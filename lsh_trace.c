@@ -0,0 +1,166 @@
+// Execution tracing. With LSH_TRACE=file in the environment, every top-level statement,
+// pipeline and pipeline stage is written to file as a Chrome trace event (open it in
+// chrome://tracing or Perfetto): when it started and ended, its pid and status, and for
+// programs the CPU time and peak RSS that wait4() reported. The time keyword prints the same
+// figures for one pipeline to stderr.
+//
+// The file is opened O_APPEND and line buffered, and each event is one line, so forked copies
+// of the shell (background statements, pdo iterations) add their events to it whole. lsh
+// scripts run by a traced script add theirs too: the shell that created the file exports
+// LSH_TRACE_OPEN=file, and a shell that finds it set for the same file appends to it instead.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "lsh_ast.h"
+
+// Microseconds on the monotonic clock, the unit trace events use.
+long long trace_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long long timeval_us(const struct timeval *tv) {
+	return tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+// Start writing trace events to path. Returns -1 if it can't be opened.
+int trace_open(struct context *context, const char *path) {
+	const char *open_path = context_get_var(context, "LSH_TRACE_OPEN");
+	context->trace_nested = open_path != NULL && strcmp(open_path, path) == 0;
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (context->trace_nested ? 0 : O_TRUNC), 0666);
+	if (fd == -1) {
+		fprintf(stderr, "LSH_TRACE: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	context->trace = fdopen(fd, "a");
+	if (context->trace == NULL) {
+		perror("fdopen");
+		close(fd);
+		return -1;
+	}
+	setvbuf(context->trace, NULL, _IOLBF, 0);
+	context->trace_pid = getpid();
+	if (!context->trace_nested) {
+		context_set_var(context, "LSH_TRACE_OPEN", path);
+		context_export_var(context, "LSH_TRACE_OPEN");
+	}
+	// Every event after the array's first starts with a comma, so forked and nested shells
+	// can write events without knowing whether anything came before them.
+	fprintf(context->trace, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"lsh\"}}\n",
+		context->trace_nested ? "," : "[", getpid());
+	return 0;
+}
+
+void trace_close(struct context *context) {
+	if (context->trace == NULL)
+		return;
+	// Only the shell that started the array ends it, not a forked copy running exit.
+	if (!context->trace_nested && getpid() == context->trace_pid)
+		fprintf(context->trace, "]\n");
+	fclose(context->trace);
+	context->trace = NULL;
+}
+
+// s with JSON string escapes, without the quotes.
+static void print_json_escaped(FILE *f, const char *s) {
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+}
+
+// A program's words as written in the script, escaped for a JSON string if json is set.
+static void print_program_text(FILE *f, const struct program *program, int json) {
+	for (const struct word *w = program->words->first; w != NULL; w = w->next) {
+		fprintf(f, "%s%s", w == program->words->first ? "" : " ", w->is_var ? "$" : "");
+		if (json)
+			print_json_escaped(f, w->text);
+		else
+			fputs(w->text, f);
+	}
+}
+
+// The start of a complete ("X") event, up to the name's opening quote.
+static void trace_event(FILE *f, const char *cat, long long start, long long end, pid_t tid) {
+	fprintf(f, ",{\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d,\"name\":\"",
+		cat, start, end - start, getpid(), tid);
+}
+
+// Record a top-level statement that ran from start to end.
+void trace_statement(struct context *context, const struct statement *statement, long long start, long long end, int rc) {
+	FILE *f = context->trace;
+	char *text = statement_text(statement);
+	trace_event(f, "statement", start, end, getpid());
+	print_json_escaped(f, text ? text : "");
+	fprintf(f, "\",\"args\":{\"status\":%d}}\n", rc);
+	free(text);
+}
+
+static void print_seconds(FILE *f, const char *label, long long us) {
+	fprintf(f, "%s\t%lldm%lld.%03llds\n", label, us / 60000000, us / 1000000 % 60, us / 1000 % 1000);
+}
+
+// time: a line per stage, then the totals in the form sh's time uses.
+static void time_report(const struct pipe_stream *pipe_stream, const struct stage_usage *stages, int n, long long start, long long end) {
+	long long user = 0, sys = 0;
+	const struct program *p = pipe_stream->first;
+	for (int i = 0; i < n; i++, p = p->next) {
+		const struct stage_usage *s = &stages[i];
+		user += timeval_us(&s->ru.ru_utime);
+		sys += timeval_us(&s->ru.ru_stime);
+		fprintf(stderr, "%7d  status %-3d  real %.3fs  user %.3fs  sys %.3fs  maxrss %ldk  ",
+			s->pid > 0 ? s->pid : getpid(), s->rc & 0xff, (s->end - s->start) / 1e6,
+			timeval_us(&s->ru.ru_utime) / 1e6, timeval_us(&s->ru.ru_stime) / 1e6, s->ru.ru_maxrss);
+		print_program_text(stderr, p, 0);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "\n");
+	print_seconds(stderr, "real", end - start);
+	print_seconds(stderr, "user", user);
+	print_seconds(stderr, "sys", sys);
+}
+
+// Report a pipeline that finished with status rc, for LSH_TRACE and/or time. stages has an
+// entry per program: pid is 0 if the shell did its work, -1 if it couldn't be started.
+void trace_pipe_stream(struct context *context, const struct pipe_stream *pipe_stream, const struct stage_usage *stages, int n, int rc) {
+	long long start = stages[0].start, end = stages[0].end;
+	for (int i = 1; i < n; i++) {
+		if (stages[i].end > end)
+			end = stages[i].end;
+	}
+
+	FILE *f = context->trace;
+	if (f != NULL) {
+		trace_event(f, "pipeline", start, end, getpid());
+		for (const struct program *p = pipe_stream->first; p != NULL; p = p->next) {
+			fprintf(f, "%s", p == pipe_stream->first ? "" : " | ");
+			print_program_text(f, p, 1);
+		}
+		fprintf(f, "\",\"args\":{\"status\":%d}}\n", rc);
+
+		// Each program gets a row (tid) of its own, so concurrent stages don't overlap.
+		const struct program *p = pipe_stream->first;
+		for (int i = 0; i < n; i++, p = p->next) {
+			const struct stage_usage *s = &stages[i];
+			trace_event(f, "program", s->start, s->end, s->pid > 0 ? s->pid : getpid());
+			print_program_text(f, p, 1);
+			fprintf(f, "\",\"args\":{\"pid\":%d,\"status\":%d,\"utime_us\":%lld,\"stime_us\":%lld,\"maxrss_kb\":%ld}}\n",
+				s->pid, s->rc, timeval_us(&s->ru.ru_utime), timeval_us(&s->ru.ru_stime), s->ru.ru_maxrss);
+		}
+	}
+
+	if (pipe_stream->timed)
+		time_report(pipe_stream, stages, n, start, end);
+}
@@ -0,0 +1,279 @@
+// Shell variables: an open-addressing hash table of "NAME=VALUE" strings with an export flag,
+// plus a cached envp of the exported ones that's only rebuilt after an exported variable changes.
+//
+// Variables live in a dense array and are known by their slot, their index in it plus one,
+// which never changes once given out. The parser interns every name a script refers to, so
+// $VAR words, assignments and loop variables carry a slot and reading or setting one at run
+// time is an array access, with no hashing or string comparison. A name can have a slot
+// before it has a value; such a variable is unset.
+//
+// The process environment isn't copied in at startup. Until something needs the whole table
+// (listing variables, or an envp that differs from the one we were started with), variables
+// missing from the table are read straight out of environ, and children are given environ as-is.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lsh_ast.h"
+
+#define VAR_TABLE_MIN_CAPACITY	64
+
+// FNV-1a over the name, which ends at a NUL or '='.
+static uint32_t var_hash(const char *name, size_t name_len) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < name_len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static size_t var_name_len(const char *name) {
+	return strcspn(name, "=");
+}
+
+// Find the bucket holding name's slot, or the empty bucket it would go in.
+static int *var_table_bucket(const struct var_table *table, const char *name, size_t name_len) {
+	size_t mask = table->nbuckets - 1;
+	for (size_t i = var_hash(name, name_len) & mask; ; i = (i + 1) & mask) {
+		int *bucket = &table->buckets[i];
+		if (*bucket == 0)
+			return bucket;
+		const struct var *v = &table->vars[*bucket - 1];
+		if (v->name_len == name_len && memcmp(v->entry, name, name_len) == 0)
+			return bucket;
+	}
+}
+
+static void var_table_grow(struct var_table *table) {
+	free(table->buckets);
+	table->nbuckets = table->nbuckets ? table->nbuckets * 2 : VAR_TABLE_MIN_CAPACITY;
+	table->buckets = calloc(table->nbuckets, sizeof(int));
+	for (size_t i = 0; i < table->count; i++)
+		*var_table_bucket(table, table->vars[i].entry, table->vars[i].name_len) = i + 1;
+}
+
+static struct var *var_at(const struct var_table *table, int slot) {
+	return &table->vars[slot - 1];
+}
+
+// The slot of the variable called name, 0 if it has none.
+static int var_find(const struct var_table *table, const char *name, size_t name_len) {
+	if (table->count == 0)
+		return 0;
+	return *var_table_bucket(table, name, name_len);
+}
+
+// The "NAME=VALUE" entry for key in the not yet imported environment.
+static const char *pending_env_find(const struct var_table *table, const char *key, size_t name_len) {
+	if (table->pending_env == NULL)
+		return NULL;
+	for (char **p = table->pending_env; *p; p++) {
+		if (strncmp(*p, key, name_len) == 0 && (*p)[name_len] == '=')
+			return *p;
+	}
+	return NULL;
+}
+
+// Store value in v's entry. Reuses the existing allocation when the new value fits, so loop
+// variables don't churn malloc.
+static void var_store(struct var_table *table, struct var *v, const char *value) {
+	size_t value_len = strlen(value);
+	size_t need = v->name_len + value_len + 2;
+	if (need > v->capacity) {
+		char *entry = realloc(v->entry, need);
+		if (entry == NULL) {
+			fprintf(stderr, "realloc() failed for variable %.*s!\n", (int)v->name_len, v->entry);
+			exit(1);
+		}
+		if (entry != v->entry && v->exported && v->set)
+			table->envp_dirty = 1;	// envp points at the old string.
+		v->entry = entry;
+		v->capacity = need;
+	}
+	v->entry[v->name_len] = '=';
+	memmove(v->entry + v->name_len + 1, value, value_len + 1);	// value may be this variable's own.
+}
+
+// The slot for key (which may be given as "NAME=..."), giving it one if it has none. A new
+// slot takes the variable's value from the environment, if it's there.
+static int var_intern(struct var_table *table, const char *key, size_t name_len) {
+	int slot = var_find(table, key, name_len);
+	if (slot != 0)
+		return slot;
+
+	if ((table->count + 1) * 4 > table->nbuckets * 3)
+		var_table_grow(table);
+	if (table->count == table->capacity) {
+		table->capacity = table->capacity ? table->capacity * 2 : VAR_TABLE_MIN_CAPACITY;
+		table->vars = realloc(table->vars, table->capacity * sizeof(struct var));
+		if (table->vars == NULL) {
+			fprintf(stderr, "realloc() failed for variables!\n");
+			exit(1);
+		}
+	}
+	struct var *v = &table->vars[table->count++];
+	memset(v, 0, sizeof(*v));
+	v->name_len = name_len;
+	v->entry = malloc(name_len + 2);
+	v->capacity = name_len + 2;
+	memcpy(v->entry, key, name_len);
+	v->entry[name_len] = '=';
+	v->entry[name_len + 1] = 0;
+	slot = table->count;
+	*var_table_bucket(table, key, name_len) = slot;
+
+	// Shadowing a variable from the environment keeps it exported. Children still get
+	// environ itself until the value changes, so envp isn't dirty yet.
+	const char *env = pending_env_find(table, key, name_len);
+	if (env != NULL) {
+		var_store(table, v, env + name_len + 1);
+		v->set = 1;
+		v->exported = 1;
+	}
+	return slot;
+}
+
+// The slot for the variable called key, for the parser to resolve names with. 0 for $?,
+// which has no slot.
+int context_var_slot(struct context *context, const char *key) {
+	if (key[0] == '?' && key[1] == 0)
+		return 0;
+	return var_intern(&context->vars, key, var_name_len(key));
+}
+
+const char *context_get_slot(const struct context *context, int slot) {
+	const struct var *v = var_at(&context->vars, slot);
+	return v->set ? v->entry + v->name_len + 1 : NULL;
+}
+
+const char *context_get_var(const struct context *context, const char *key) {
+	if (key[0] == '?' && key[1] == 0)
+		return context->last_status_text;
+	size_t name_len = var_name_len(key);
+	int slot = var_find(&context->vars, key, name_len);
+	if (slot != 0)
+		return context_get_slot(context, slot);	// The environment was checked for it already.
+	const char *entry = pending_env_find(&context->vars, key, name_len);
+	return entry ? entry + name_len + 1 : NULL;
+}
+
+void context_set_slot(struct context *context, int slot, const char *value) {
+	struct var_table *table = &context->vars;
+	struct var *v = var_at(table, slot);
+	var_store(table, v, value ? value : "");
+	if (v->exported && table->pending_env != NULL)
+		table->envp_dirty = 1;	// Children can no longer be given environ as it is.
+	v->set = 1;
+
+	if (v->name_len == 4 && memcmp(v->entry, "PATH", 4) == 0)
+		path_cache_clear(context);
+}
+
+void context_set_var(struct context *context, const char *key, const char *value) {
+	context_set_slot(context, context_var_slot(context, key), value);
+}
+
+// Mark a variable as exported to child processes, creating it empty if needed.
+void context_export_var(struct context *context, const char *key) {
+	struct var_table *table = &context->vars;
+	struct var *v = var_at(table, var_intern(table, key, var_name_len(key)));
+	if (!v->set) {
+		var_store(table, v, "");
+		v->set = 1;
+	}
+	if (!v->exported) {
+		v->exported = 1;
+		table->envp_dirty = 1;
+	}
+}
+
+// Import a "NAME=VALUE" string from the process environment as an exported variable.
+void context_import_env(struct context *context, const char *entry) {
+	const char *eq = strchr(entry, '=');
+	if (eq == NULL || eq == entry)
+		return;
+	struct var_table *table = &context->vars;
+	struct var *v = var_at(table, var_intern(table, entry, eq - entry));
+	var_store(table, v, eq + 1);
+	v->set = 1;
+	v->exported = 1;
+	table->envp_dirty = 1;
+}
+
+// Use env (normally environ) as the initial variables, importing it lazily.
+void context_set_environ(struct context *context, char **env) {
+	context->vars.pending_env = env;
+}
+
+// Copy whatever of the environment hasn't been shadowed yet into the table.
+static void context_import_pending_env(struct context *context) {
+	char **env = context->vars.pending_env;
+	if (env == NULL)
+		return;
+	context->vars.pending_env = NULL;
+	for (char **p = env; *p; p++) {
+		if (var_find(&context->vars, *p, var_name_len(*p)) == 0)
+			context_import_env(context, *p);
+	}
+}
+
+// The environment for child processes: every exported variable, NULL terminated.
+// Rebuilt only when an exported variable has changed since the last call.
+char **context_envp(struct context *context) {
+	struct var_table *table = &context->vars;
+	if (table->pending_env != NULL && !table->envp_dirty)
+		return table->pending_env;	// Nothing exported has changed.
+	if (table->envp != NULL && !table->envp_dirty)
+		return table->envp;
+	context_import_pending_env(context);
+
+	size_t n = 0;
+	for (size_t i = 0; i < table->count; i++)
+		n += table->vars[i].set && table->vars[i].exported;
+	table->envp = realloc(table->envp, (n + 1) * sizeof(char *));
+	n = 0;
+	for (size_t i = 0; i < table->count; i++) {
+		if (table->vars[i].set && table->vars[i].exported)
+			table->envp[n++] = table->vars[i].entry;
+	}
+	table->envp[n] = NULL;
+	table->envp_dirty = 0;
+	return table->envp;
+}
+
+// Print variables as NAME=VALUE, or only exported ones as "export NAME=VALUE".
+void context_print_vars(struct context *context, int exported_only) {
+	context_import_pending_env(context);
+	const struct var_table *table = &context->vars;
+	for (size_t i = 0; i < table->count; i++) {
+		const struct var *v = &table->vars[i];
+		if (!v->set || (exported_only && !v->exported))
+			continue;
+		printf("%s%s\n", exported_only ? "export " : "", v->entry);
+	}
+}
+
+// Call fn with the name of each variable starting with prefix.
+void context_each_var(struct context *context, const char *prefix, void (*fn)(const char *name, size_t len, void *arg), void *arg) {
+	context_import_pending_env(context);
+	const struct var_table *table = &context->vars;
+	size_t prefix_len = strlen(prefix);
+	for (size_t i = 0; i < table->count; i++) {
+		const struct var *v = &table->vars[i];
+		if (v->set && v->name_len >= prefix_len && strncmp(v->entry, prefix, prefix_len) == 0)
+			fn(v->entry, v->name_len, arg);
+	}
+}
+
+void context_free_vars(struct context *context) {
+	struct var_table *table = &context->vars;
+	for (size_t i = 0; i < table->count; i++)
+		free(table->vars[i].entry);
+	free(table->vars);
+	free(table->buckets);
+	free(table->envp);
+	memset(table, 0, sizeof(*table));
+}
@@ -0,0 +1,33 @@
+echo Arithmetic
+echo $((1 + 2 * 3)) $(( (1 + 2) * 3 )) $((7 / 2)) $((7 % 3)) $((-7 / 2)) $((2 ** 10)) $((-2 ** 2))
+echo $((1 << 4)) $((256 >> 2)) $((0x10)) $((010)) $((6 & 3)) $((6 | 3)) $((6 ^ 3)) $((~0))
+echo $((5 > 3)) $((5 < 3)) $((5 >= 5)) $((5 <= 4)) $((5 == 3)) $((5 != 3)) $((!0)) $((!7))
+echo $((1 && 0)) $((1 || 0)) $((5 > 3 ? 10 : 20)) $((1, 2)) $(( ))
+X=5
+echo $((X + 1)) $(($X * 2)) $((UNSET + 1)) $X
+Y=$((X += 2))
+echo $X $Y
+echo $((j++)) $((j++)) $j $((++j)) $((--j)) $((j *= 3)) $((j <<= 1)) $j
+echo $((a = b = 3)) $a $b
+I=0
+for n in 1 2 3 4 5 ; do
+	I=$((I + n * n))
+done
+echo sum $I
+echo $(echo $((I / 5)))
+K=1
+echo $(echo $((K++))) $K
+let 'Z = 3 * 4' 'Z++'
+echo $Z $?
+let 'Z - Z'
+echo $?
+let Z++
+echo $Z
+cd /tmp
+n=41
+echo to file > $((n + 1))
+cat 42
+echo again > $((n++))
+cat 41
+echo n is $n
+rm 41 42
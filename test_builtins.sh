@@ -0,0 +1,44 @@
+
+echo Builtin commands
+echo -n no newline
+echo
+echo -e 'tab\there'
+echo -E 'tab\there'
+echo -x is not an option
+printf '%s-%d\n' a 1 b 2 c
+printf '%5s|%-5s|%05d|%x|%o|%c\n' ab cd 42 255 8 xyz
+printf '%b\n' 'esc\tape'
+printf 'no-args\n'
+: ignored arguments
+if true ; then
+	echo true works
+fi
+if false ; then
+	echo false is broken
+else
+	echo false works
+fi
+cd /tmp
+pwd
+for x in a b c ; do
+	echo x is $x
+	true
+done
+echo 'quoted   spaces' stay
+v='split  me'
+echo $v
+w=$v
+printf '%s|' $w 'one arg'
+echo
+echo Builtins as pipeline stages
+printf '%s\n' b a c | sort
+pwd | cat
+cd / | cat
+pwd
+echo x | exit 3 | cat
+echo piped > /tmp/lsh_test_builtin_stage | cat
+cat /tmp/lsh_test_builtin_stage
+rm /tmp/lsh_test_builtin_stage
+nothing=
+$nothing
+echo empty command is $?
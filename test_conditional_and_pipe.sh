@@ -2,3 +2,11 @@ if cat haystack | grep -q needle ; then
 	echo needle found
 fi
 
+
+echo Reading a file through cat
+cat test_section5_b.sh | wc -l
+cat nonexistent | wc -l
+cat / | wc -l
+set -o pipefail
+cat nonexistent | wc -l
+echo $?
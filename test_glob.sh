@@ -0,0 +1,26 @@
+echo Pattern expansion
+echo test_section?.sh
+echo test_section5_[ab].sh
+echo test_section5_[!a].sh
+echo no_such_file_*.txt
+echo 'test_*.sh'
+mkdir -p /tmp/lsh_glob_test/a /tmp/lsh_glob_test/b
+touch /tmp/lsh_glob_test/a/1.log /tmp/lsh_glob_test/a/2.log /tmp/lsh_glob_test/b/3.log /tmp/lsh_glob_test/.hidden.log
+echo /tmp/lsh_glob_test/*/*.log
+echo /tmp/lsh_glob_test/*
+for f in /tmp/lsh_glob_test/a/*.log ; do
+	echo found $f
+done
+cd /tmp/lsh_glob_test/b
+for i in 4 5 ; do
+	touch $i
+	echo *
+done
+echo one match > /tmp/lsh_glob_test/a/*.txt
+cat /tmp/lsh_glob_test/a/*.txt
+echo redirected > /tmp/lsh_glob_test/b/[3]*
+cat /tmp/lsh_glob_test/b/3.log
+echo two matches 2> /dev/null > /tmp/lsh_glob_test/a/*.log
+echo ambiguous $?
+cd /
+rm -r /tmp/lsh_glob_test
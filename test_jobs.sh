@@ -0,0 +1,17 @@
+echo Background jobs
+sh -c 'sleep 0.2 ; echo first stage' | sh -c 'cat ; exit 4' &
+wait %1
+echo pipeline finished with $?
+sleep 0.5 &
+sh -c 'exit 3' &
+wait -n
+echo first finished with $?
+wait -n
+echo second finished with $?
+wait -n
+echo nothing left $?
+for i in 1 2 3 4 5 6 7 8 9 10 ; do
+	sh -c 'sleep 0.1 ; echo job' &
+done
+wait
+echo all jobs finished
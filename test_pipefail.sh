@@ -0,0 +1,19 @@
+echo Pipeline status
+false | true
+echo $?
+true | false
+echo $?
+set -o pipefail
+false | true
+echo $?
+true | sh -c 'exit 3' | true
+echo $?
+if false | cat ; then
+	echo pipefail is broken
+else
+	echo pipefail works
+fi
+set +o pipefail
+if false | cat ; then
+	echo pipefail is off
+fi
@@ -0,0 +1,25 @@
+echo Redirections
+echo first > /tmp/lsh_redirect_test
+echo second >> /tmp/lsh_redirect_test
+cat < /tmp/lsh_redirect_test
+wc -l < /tmp/lsh_redirect_test > /tmp/lsh_redirect_count
+cat /tmp/lsh_redirect_count
+ls /nonexistent 2> /tmp/lsh_redirect_test
+echo $?
+wc -l /tmp/lsh_redirect_test
+sh -c 'echo to stderr 1>&2' 2>&1 | tr a-z A-Z
+echo out 1>&2 2> /dev/null
+printf 'a\nb\n' 2>&1 > /tmp/lsh_redirect_test | wc -l
+cat /tmp/lsh_redirect_test
+FILE=/tmp/lsh_redirect_test
+echo var target > $FILE
+cat $FILE
+echo subst target > $(echo /tmp/lsh_redirect_test)
+cat /tmp/lsh_redirect_test
+while read line ; do
+	echo read $line
+done < $(echo /tmp/lsh_redirect_test)
+two='a b'
+echo split target 2> /dev/null > $two
+echo ambiguous $?
+rm /tmp/lsh_redirect_test /tmp/lsh_redirect_count
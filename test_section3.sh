@@ -30,3 +30,9 @@ for x in a b c ; do
 	echo x is $x
 done
 
+
+echo Testing a script without a shebang line
+echo 'echo no shebang, got $1 $2' > /tmp/lsh_test_noshebang
+chmod +x /tmp/lsh_test_noshebang
+/tmp/lsh_test_noshebang one two
+rm /tmp/lsh_test_noshebang
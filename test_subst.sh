@@ -0,0 +1,28 @@
+echo Command substitution
+X=abc
+echo builtin: $(echo hello $X) $(printf %s-%s a b)
+echo pipeline: $(printf 'a\nb\nc\n' | wc -l) $(echo one two three | cut -d' ' -f2)
+echo split: $(printf 'x  y\nz\n\n')
+Y=$(printf 'keep  spaces\n\n')
+echo $Y
+Z=$(false)
+echo status $?
+Z=$(true)
+echo status $?
+cd /tmp
+echo $(cd / ; pwd) $(pwd)
+for w in $(echo 3 2 1) go ; do
+	echo $w
+done
+echo nested: $(echo a $(echo b $(echo c)))
+if test $(echo 1) -eq 1 ; then
+	echo compared
+fi
+echo $(for i in 1 2 3 ; do
+	echo $i
+done)
+echo empty: $(true) end
+false
+echo $PIPESTATUS $(sh -c true | cat | cat | cat) kept
+false
+echo $(true | cat) $PIPESTATUS kept
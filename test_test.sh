@@ -0,0 +1,57 @@
+echo test and [
+mkdir -p /tmp/lsh_test_test/dir
+cd /tmp/lsh_test_test
+echo data > file
+touch empty
+ln -sf file link
+for p in file empty dir link missing ; do
+	for op in -e -f -d -s -L -r -x ; do
+		if [ $op $p ] ; then
+			echo $p $op yes
+		fi
+	done
+done
+if test -f file -a ! -d file ; then
+	echo and not
+fi
+if [ -d file -o -s file ] ; then
+	echo or
+fi
+X=abc
+if [ $X = abc ] ; then
+	echo equal
+fi
+if [ $X != abc ] ; then
+	echo wrong
+elif [ -n $X ] ; then
+	echo non-empty
+fi
+if [ 10 -gt 9 -a 3 -le 3 -a 2 -ne 1 ] ; then
+	echo integers
+fi
+[ 1 -eq 2 ]
+echo status $?
+test
+echo status $?
+[ -f ]
+echo status $?
+for i in 1 2 ; do
+	if [ -f later ] ; then
+		echo later exists
+	else
+		echo no later
+	fi
+	touch later
+done
+if [ later -nt missing ] ; then
+	echo newer
+fi
+sh -c 'sleep 0.2 ; touch /tmp/lsh_test_test/flag' &
+i=0
+while [ ! -f /tmp/lsh_test_test/flag ] ; do
+	i=$((i + 1))
+done
+wait
+echo flag appeared
+cd /
+rm -r /tmp/lsh_test_test
@@ -0,0 +1,37 @@
+echo While loops and read
+i=0
+while [ $i -lt 3 ] ; do
+	echo i is $i
+	i=$((i + 1))
+done
+echo status $?
+until [ $i -eq 0 ] ; do
+	i=$((i - 1))
+	false
+done
+echo status $? i $i
+while false ; do
+	echo never
+done
+echo status $?
+printf 'a b c\n  lead  trail  \none\n\nback\\ slash x\ncont\\\ninued\nlast' > /tmp/lsh_read_in
+while read x y ; do
+	echo x $x y $y
+done < /tmp/lsh_read_in
+while read -r x y ; do
+	echo raw x $x y $y
+done < /tmp/lsh_read_in
+read a b < /tmp/lsh_read_in
+echo a $a b $b
+read -r < /tmp/lsh_read_in
+echo reply $REPLY
+n=0
+while read x ; do
+	n=$((n + 1))
+	echo $x | tr a-z A-Z
+done < /tmp/lsh_read_in
+echo n $n
+rm /tmp/lsh_read_in
+echo while until time are words here
+x=until
+echo $x